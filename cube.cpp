@@ -1,34 +1,449 @@
 /*
         clang++ -O3 -o cube cube.cpp
         g++ -O3 -o cube cube.cpp
+
+        Add -msse4.1 (4 cells at a time) or -mavx2 (8 cells at a time) to use the SIMD pixel kernel
+        g++ -O3 -mavx2 -o cube cube.cpp
+
+        Add -DNDEBUG to drop the debug check that frames after the first make no heap allocations
 */
 
 
+#define GLM_FORCE_INTRINSICS // Lets glm pick up the instruction set enabled on the command line so the wrappers in glm/simd can be used
 #include <iostream>
 #include "glm/glm.hpp"
+#include "glm/simd/common.h"
 #include "glm/gtc/matrix_transform.hpp"
 #include "glm/gtc/type_ptr.hpp"
 #include <chrono>
 #include <vector>
+#include <tuple>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <cstdio>
+#include <cfloat>
+#include <new>
+#include <type_traits>
+#include <functional>
+#include <memory>
+#include <initializer_list>
+#include <stdexcept>
+#include <exception>
+#include <system_error>
+#include <string>
 #include <windows.h>  
 
 
-const int gridWidth = 124;
-const int gridHeight = 70;
+// Builds without NDEBUG count every heap allocation, so endFrame() can assert that a frame after the first few
+// allocated nothing and everything transient came out of the frame arena. The count is over all threads, so the other
+// stages of the frame pipeline have to keep to that too
+#ifndef NDEBUG
+std::atomic<long long> heapAllocations(0);
+
+
+// Every form of new and delete goes through these two. The pointer malloc returned is kept just in front of the memory
+// handed out, which lets the aligned forms share the plain ones and every delete free the same way
+void* countedAllocate(std::size_t size, std::size_t alignment) noexcept {
+    heapAllocations++;
+    alignment = std::max<std::size_t>(alignment, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    if (size > SIZE_MAX - alignment - sizeof(void*))
+    {
+        return nullptr;
+    }
+    char* base = static_cast<char*>(std::malloc(size + alignment + sizeof(void*)));
+    if (base == nullptr)
+    {
+        return nullptr;
+    }
+    uintptr_t start = (reinterpret_cast<uintptr_t>(base) + sizeof(void*) + alignment - 1) & ~(uintptr_t(alignment) - 1);
+    std::memcpy(reinterpret_cast<char*>(start) - sizeof(void*), &base, sizeof(base));
+    return reinterpret_cast<void*>(start);
+}
+
+
+void countedFree(void* memory) noexcept {
+    if (memory != nullptr)
+    {
+        void* base;
+        std::memcpy(&base, static_cast<char*>(memory) - sizeof(void*), sizeof(base));
+        std::free(base);
+    }
+}
+
+
+void* countedNew(std::size_t size, std::size_t alignment) {
+    if (void* memory = countedAllocate(size, alignment))
+    {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+
+void* operator new(std::size_t size) { return countedNew(size, 0); }
+void* operator new[](std::size_t size) { return countedNew(size, 0); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return countedNew(size, static_cast<std::size_t>(alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return countedNew(size, static_cast<std::size_t>(alignment)); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size, 0); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size, 0); }
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAllocate(size, static_cast<std::size_t>(alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedAllocate(size, static_cast<std::size_t>(alignment)); }
+void operator delete(void* memory) noexcept { countedFree(memory); }
+void operator delete[](void* memory) noexcept { countedFree(memory); }
+void operator delete(void* memory, std::size_t) noexcept { countedFree(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { countedFree(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { countedFree(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { countedFree(memory); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { countedFree(memory); }
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept { countedFree(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { countedFree(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { countedFree(memory); }
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { countedFree(memory); }
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept { countedFree(memory); }
+#endif
+
+
+// Bump allocator for everything that only lives for one frame. Allocating moves a pointer forward and reset() at the
+// start of the next frame frees all of it at once. When a frame needs more than the block holds the rest comes from
+// the heap and the next reset() grows the block to what that frame used, so only the first frames and frames that
+// need more than any frame before them touch the heap
+class FrameArena
+{
+public:
+    ~FrameArena() {
+        releaseOverflow();
+        ::operator delete(block);
+    }
+
+
+    void* allocate(size_t bytes, size_t alignment) {
+        size_t start = (used + alignment - 1) & ~(alignment - 1);
+        if (start + bytes <= capacity)
+        {
+            used = start + bytes;
+            return block + start;
+        }
+
+
+        // Overflow blocks come from the heap like any other allocation, overflowed() tells endFrame() why
+        overflowBytes += bytes + alignment;
+        overflowedThisFrame = true;
+        void* memory = ::operator new(bytes + alignment);
+        overflow.push_back(memory);
+        return reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(memory) + alignment - 1) & ~(uintptr_t(alignment) - 1));
+    }
+
+
+    // Grows the most recent allocation in place if the block has room after it
+    bool extend(void* allocation, size_t oldBytes, size_t newBytes) {
+        char* end = static_cast<char*>(allocation) + oldBytes;
+        if (end != block + used || used - oldBytes + newBytes > capacity)
+        {
+            return false;
+        }
+        used = used - oldBytes + newBytes;
+        return true;
+    }
+
+
+    void reset() {
+        overflowedThisFrame = false;
+        if (overflowBytes > 0)
+        {
+            size_t needed = used + overflowBytes;
+            releaseOverflow();
+            ::operator delete(block);
+            capacity = needed + needed / 2;
+            block = static_cast<char*>(::operator new(capacity));
+        }
+        used = 0;
+    }
+
+
+    // True when the current frame had to go to the heap for arena memory
+    bool overflowed() const { return overflowedThisFrame; }
+
+private:
+    void releaseOverflow() {
+        for (void* memory : overflow) {
+            ::operator delete(memory);
+        }
+        overflow.clear();
+        overflowBytes = 0;
+    }
+
+
+    char* block = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t overflowBytes = 0;
+    bool overflowedThisFrame = false;
+    std::vector<void*> overflow;
+};
+FrameArena frameArena;
+
+
+#ifndef NDEBUG
+long long frameStartAllocations = 0;
+int framesChecked = 0;
+#endif
+
+
+// Frees everything the previous frame took from the arena. Growing the arena happens in here, before the frame starts
+// counting its allocations
+void beginFrame() {
+    frameArena.reset();
+#ifndef NDEBUG
+    frameStartAllocations = heapAllocations;
+#endif
+}
+
+
+// Asserts that the frame made no heap allocations. The first frame is let off because it sets up what is only made on
+// first use, and so is a frame whose arena ran out because the arena grows before the next one. The output of the
+// vertex stage is sized before any frame, by reserveVertexStage
+void endFrame() {
+#ifndef NDEBUG
+    bool allocated = heapAllocations != frameStartAllocations;
+    assert((!allocated || framesChecked == 0 || frameArena.overflowed()) && "a steady state frame allocated from the heap");
+    framesChecked++;
+#endif
+}
+
+
+// Growable array of trivially copyable elements in the frame arena. clear() forgets the storage instead of keeping it,
+// because storage from an earlier frame is gone after reset(). Growing tries to extend the storage in place first,
+// which works whenever nothing else was allocated from the arena since
+template <typename T>
+class ArenaVector
+{
+    static_assert(std::is_trivially_copyable<T>::value, "ArenaVector moves its elements with memcpy");
+
+public:
+    void push_back(const T& value) {
+        if (count == capacity)
+        {
+            reserve(std::max<size_t>(16, capacity * 2));
+        }
+        items[count++] = value;
+    }
+
+
+    void append(const T* values, size_t n) {
+        if (count + n > capacity)
+        {
+            reserve(std::max(count + n, capacity * 2));
+        }
+        std::memcpy(items + count, values, n * sizeof(T));
+        count += n;
+    }
+
+
+    void reserve(size_t n) {
+        if (n <= capacity)
+        {
+            return;
+        }
+        if (items == nullptr || !frameArena.extend(items, capacity * sizeof(T), n * sizeof(T)))
+        {
+            T* grown = static_cast<T*>(frameArena.allocate(n * sizeof(T), alignof(T)));
+            if (count > 0)
+            {
+                std::memcpy(grown, items, count * sizeof(T));
+            }
+            items = grown;
+        }
+        capacity = n;
+    }
+
+
+    void clear() {
+        items = nullptr;
+        count = capacity = 0;
+    }
+
+
+    size_t size() const { return count; }
+    T* data() { return items; }
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+    T* begin() { return items; }
+    T* end() { return items + count; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+
+private:
+    T* items = nullptr;
+    size_t count = 0;
+    size_t capacity = 0;
+};
+
+
+// Size of the part of the terminal the frame is drawn in, in characters
+const int screenWidth = 124;
+const int screenHeight = 70;
 const int refreshRate = 100;
 
 
+// How the grid is written to the terminal, can be cycled while running with the O key
+enum class OutputMode
+{
+    Ascii,     // One grid cell per character
+    HalfBlock, // One above the other, two grid cells per character drawn as the colours of its top and bottom half
+    Braille    // Two across and four down, eight grid cells per character drawn as the dots of a braille pattern
+};
+OutputMode outputMode = OutputMode::Ascii;
+
+
+// The output mode decides how many grid cells go into one character, so the grid buffers are sized for the mode with
+// the most and only gridWidth by gridHeight cells of them are in use. Rows are always gridPitch cells apart
+const int gridPitch = screenWidth * 2;
+const int maxGridHeight = screenHeight * 4;
+int gridWidth = screenWidth;
+int gridHeight = screenHeight;
+float cellWidth = 1.0f;  // Size of a grid cell in characters, the lighting works in characters so it looks the same in every mode
+float cellHeight = 1.0f;
+
+
+// Text for the terminal. The storage is allocated once with room for the largest frame, so writing a frame never
+// allocates, and it outlives the frame arena because the output thread writes it while the next frame is drawn
+class FrameText
+{
+public:
+    // Makes room for at least bytes, dropping the text if it has to allocate
+    void reserve(size_t bytes) {
+        if (bytes > capacity)
+        {
+            storage.reset(new char[bytes]);
+            capacity = bytes;
+            count = 0;
+        }
+    }
+
+
+    void push_back(char c) {
+        assert(count < capacity);
+        storage[count++] = c;
+    }
+
+
+    void append(const char* text, size_t n) {
+        assert(count + n <= capacity);
+        std::memcpy(storage.get() + count, text, n);
+        count += n;
+    }
+    void append(const char* text) { append(text, std::strlen(text)); }
+    void append(const std::string& text) { append(text.data(), text.size()); }
+
+
+    // Removes the bytes from begin up to end, moving the text after them down
+    void erase(size_t begin, size_t end) {
+        assert(begin <= end && end <= count);
+        std::memmove(storage.get() + begin, storage.get() + end, count - end);
+        count -= end - begin;
+    }
+
+
+    void resize(size_t bytes) {
+        assert(bytes <= count);
+        count = bytes;
+    }
+
+
+    void clear() { count = 0; }
+    const char* data() const { return storage.get(); }
+    size_t size() const { return count; }
+
+private:
+    std::unique_ptr<char[]> storage;
+    size_t count = 0;
+    size_t capacity = 0;
+};
+
+
+// One character on the terminal: up to 3 bytes of UTF-8 and the grays of the 256 colour palette it is drawn with, -1
+// for the terminal's own colours. Cells are compared bytewise, so the unused bytes of the glyph are always zero
+struct TerminalCell
+{
+    char glyph[3];
+    uint8_t length;
+    int8_t foreground;
+    int8_t background;
+};
+static_assert(sizeof(TerminalCell) == 6, "terminal cells are compared with memcmp and must have no padding");
+
+
+// A finished frame as the terminal should show it, every output mode fills the whole screen of characters
+struct TerminalFrame
+{
+    TerminalCell cells[screenHeight][screenWidth];
+    float frameTime;
+};
+
+
 // The grid which is the amount of characters taking up terminal for the height and width
-char grid[gridHeight][gridWidth];
-std::string frontBuffer; // Buffer currently being displayed
-std::string backBuffer;  // Buffer being written to
+char grid[maxGridHeight][gridPitch];
+
+// Formats the depth of a cell can be stored in, can be switched while running with the Z key
+enum class DepthFormat
+{
+    Float32, // 32 bit float
+    Unorm24, // 24 bit unsigned normalized integer in the low bits of a 32 bit word
+    Unorm16, // 16 bit unsigned normalized integer
+    Packed24 // 24 bit unsigned normalized integer in the high bits of a 32 bit word and the cell's character in the low 8 bits
+};
+DepthFormat depthFormat = DepthFormat::Float32;
+
+
+// Depth of every cell, only the member matching depthFormat is in use
+union DepthBuffer
+{
+    float float32[maxGridHeight][gridPitch];
+    uint32_t unorm24[maxGridHeight][gridPitch];
+    uint16_t unorm16[maxGridHeight][gridPitch];
+    uint32_t packed24[maxGridHeight][gridPitch]; // The grid is filled in from the low bytes once the frame is drawn
+};
+DepthBuffer zBuffer;
+
+
+// Which rasterizer fills the triangles, can be switched while running with the 1, 2 and 3 keys
+enum class Rasterizer
+{
+    Scanline,     // Walks the triangle line by line between its left and right side
+    EdgeFunction, // Tests every cell in the triangle's bounding box against the three edges
+    Tiled         // Edge function rasterizer run on screen tiles by a pool of threads
+};
+Rasterizer rasterizer = Rasterizer::EdgeFunction;
+
+
+// Visibility buffer, switched on and off with the V key. The edge function and tiled rasterizers then only write the
+// depth and the ID of the triangle that covers each cell, and the cells are shaded once the whole frame has been drawn,
+// so a cell costs one lighting calculation however many triangles were drawn over it
+bool visibilityBuffer = false;
+const uint32_t noTriangle = 0xFFFFFFFF; // ID of a cell no triangle was drawn into
+uint32_t triangleIds[maxGridHeight][gridPitch];
+
 
-double zBuffer[gridHeight][gridWidth];
+// Sub-cell coverage, switched on and off with the C key. The edge function and tiled rasterizers then also test a grid
+// of samples inside every cell and keep a mask of the covered ones, and cells the scene only partly covers are drawn
+// with a character matching the shape of the covered part instead of a shading character
+bool coverageSampling = false;
+const int coverageSamples = 8;    // Two across and four down, sample s is in column s % 2 and row s / 2
+const uint8_t fullCoverage = 0xFF;
+uint8_t coverageMasks[maxGridHeight][gridPitch];
 
 // Camera Varibles, matrices and vectors
 glm::mat4 transform = glm::mat4(1.0f);
 glm::vec3 cameraPos = glm::vec3(2.0f, 0.0f, 2.0f);
 glm::vec3 lookAt = cameraPos + glm::vec3(-1.0f, 0.0f, 0.0f);
+glm::vec3 renderCameraPos = cameraPos; // The raster thread's copy of cameraPos for the frame it is drawing
 glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
 
 
@@ -45,7 +460,7 @@ float farPlane = 7.0f;
 
 
 float fov = glm::radians(90.0f);
-float aspectRatio = static_cast<float>(gridWidth) / static_cast<float>(gridHeight);
+float aspectRatio = static_cast<float>(screenWidth) / static_cast<float>(screenHeight);
 glm::mat4 cameraRotation = glm::rotate(glm::mat4(1.0f), cameraRotationY, glm::vec3(0.0f, 1.0f, 0.0f)); // Y-axis rotation
 glm::vec3 forward = glm::normalize(glm::vec3(cameraRotation * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f))); // Forward direction
 glm::vec3 right = glm::normalize(glm::cross(forward, cameraUp)); // Right direction
@@ -63,6 +478,13 @@ glm::vec3 lightDirection = glm::normalize(glm::vec3(1.0f, -1.0f, -1.0f));
 glm::vec3 lightPosition = glm::vec3(1.0f, -1.0f, 0.0f);
 
 
+// Characters a cell can be drawn with, from the darkest to the brightest, and the gamma the light intensity is raised to
+// before it is matched to one of them. Both are baked into glyphTable when the program starts
+const char glyphRamp[] = ".:-=+*#%@";
+const float glyphGamma = 0.5f;
+const int glyphLevels = 256; // Number of steps the light intensity is quantized to
+
+
 // Vertices for a pyramid (position only)
 const float vertices[] = {
     // Front face
@@ -112,399 +534,4664 @@ const unsigned int indices[] = {
 };
 
 
-// Copy of vertices for transformations
-float transformedVertices[24];
+// Vertex positions as one stream per component, so the vertex stage can load simdWidth vertices with one instruction
+// per component. The streams are padded with zeros to a multiple of streamPadding floats, which is more than any SIMD
+// width, so the vertex stage never needs a scalar tail. The streams only point at the floats, which a Mesh owns
+const int streamPadding = 16;
+struct VertexStreams
+{
+    int count = 0;
+    const float* x = nullptr;
+    const float* y = nullptr;
+    const float* z = nullptr;
+};
+
+
+// Fixed point grid position and depth of a vertex, packed into 16 bytes and aligned to them so a vertex is a single SSE
+// load and never straddles a cache line. The last word carries the clip codes of the vertex stage and is spare after it
+struct alignas(16) ScreenVertex
+{
+    int x, y;
+    float z;
+    int clipCodes; // Frustum outcode in the low byte, clipping plane outcode in the byte above it
+};
+
+
+// The three vertices of a triangle back to back, the rasterizers take triangles as one contiguous array of these
+struct ScreenTriangle
+{
+    ScreenVertex v[3];
+};
+
+
+// Output of the vertex stage. Every vertex keeps its clip space position, one stream per component, for the triangles
+// that have to be clipped, and its screen vertex for the ones that don't
+struct TransformedVertices
+{
+    int count = 0;
+    std::vector<float> clipX, clipY, clipZ, clipW;
+    std::vector<ScreenVertex> screen;
+};
+
+
+TransformedVertices transformedVertices;
+
+
+// Screen positions are fixed point numbers with subPixelBits bits after the point, so a vertex keeps its position inside
+// a cell instead of being snapped to the cell's corner. Cell x covers [x, x + 1) and is sampled at its center x + 0.5
+const int subPixelBits = 4;
+const int subPixelScale = 1 << subPixelBits;
+const int subPixelHalf = subPixelScale / 2;
+const int coverageSampleX[2] = { 4, 12 };        // Sub pixel offsets of the coverage sample columns from the left of the cell
+const int coverageSampleY[4] = { 2, 6, 10, 14 }; // Sub pixel offsets of the coverage sample rows from the top of the cell
 
 
 int mapToGrid(float coord, int maxIndex) {
-    // Map NDC (-1,1) range to (0, maxIndex)
-    return static_cast<int>((coord + 1.0f) * 0.5f * maxIndex);
+    // Map NDC (-1,1) range to (0, maxIndex) in fixed point, rounded to the nearest sub pixel step
+    return static_cast<int>(std::floor((coord + 1.0f) * static_cast<float>(maxIndex * subPixelHalf) + 0.5f));
+}
+
+
+glm::vec3 calculateNormal(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, const glm::vec3& cameraPos) {
+    glm::vec3 normal = glm::normalize(glm::cross(p2 - p1, p3 - p1)); // Calculates the normal of the triangle
+    glm::vec3 viewDir = glm::normalize(cameraPos - p1); // Finds the view direction of the camera
+    if (glm::dot(normal, viewDir) > 0)
+    {
+        normal = -normal; // Flip the normal if it's pointing towards the camera
+    }
+    return normal;
 }
 
 
-// Clears screen every frame
-void clearScreen() {
-    std::cout << "\033[H";
+// Calculates how much light a triangle receives based on its normal and the direction of the light
+float calculateAngleIntensity(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3) {
+    glm::vec3 normal = calculateNormal(p1, p2, p3, renderCameraPos); // Calculates the normal for the triangle
+    float angleIntensity = glm::dot(normal, -lightDirection); // Calculates the lighting of the triangle by using the normal and comparing it to see how it is pointing at the light source
+    // A triangle squashed to a line has no normal and a NaN intensity, which the comparison turns into no light
+    return angleIntensity > 0.0f ? std::pow(std::min(angleIntensity, 1.0f), 1.5f) : 0.0f;
 }
 
-void applyTransform(glm::mat4& transform) {
-    for (int i = 0; i < sizeof(transformedVertices) / sizeof(transformedVertices[0]); i += 3) {
-        glm::vec4 vertex = glm::vec4(vertices[i], vertices[i + 1], vertices[i + 2], 1.0f);
-        vertex = transform * vertex;
 
+// Intensity to character lookup table. Entry i is the character for an intensity of i / (glyphLevels - 1), so shading a
+// cell only has to scale its intensity and load the character instead of going through the ramp and the gamma curve.
+// The entries are ints so the SIMD kernel can gather them
+struct GlyphTable
+{
+    int glyphs[glyphLevels];
+};
 
-        // Perform perspective divide to get NDC
-        if (std::abs(vertex.w) > 1e-6f)
-        {
-            vertex.x /= vertex.w;
-            vertex.y /= vertex.w;
-            vertex.z /= vertex.w;
 
-            // Clip to the near and far planes
-            if (vertex.z < nearPlane)
-            {
-                continue; // Skip this vertex if it's too close
-            }
-            if (vertex.z > farPlane)
-            {
-                continue; // Skip this vertex if it's too far
-            }
-            if (vertex.z == nearPlane)
-            {
-                continue; // Skip this vertex if it is equal to the nearPlane or in other words too close
-            }
-            if (vertex.z == farPlane)
+GlyphTable buildGlyphTable(const char* ramp, float gamma) {
+    GlyphTable table;
+    int rampLength = static_cast<int>(std::strlen(ramp));
+    for (int i = 0; i < glyphLevels; i++) {
+        float intensity = std::pow(static_cast<float>(i) / (glyphLevels - 1), gamma);
+        int glyph = std::min(static_cast<int>(intensity * rampLength), rampLength - 1);
+        table.glyphs[i] = static_cast<unsigned char>(ramp[glyph]);
+    }
+    return table;
+}
+const GlyphTable glyphTable = buildGlyphTable(glyphRamp, glyphGamma);
+
+
+// Position of an intensity in glyphTable
+inline int glyphLevel(float intensity) {
+    return static_cast<int>(glm::clamp(intensity, 0.0f, 1.0f) * (glyphLevels - 1) + 0.5f);
+}
+
+
+// Shades a single pixel of a triangle and returns the character it should be drawn with
+char shadePixel(int x, int y, float z, float angleIntensity) {
+    glm::vec3 Pos = glm::vec3(x * cellWidth, y * cellHeight, z); // Setting the position as a vector so we can normalize it
+    glm::vec3 normPos = glm::normalize(Pos); // Normalize for lighting calculations only
+
+
+    float dx = normPos.x - lightPosition.x; // Calculates the difference between the x position of the pixel and x position of the lightposition
+    float dy = normPos.y - lightPosition.y; // Calculates the difference between the y position of the pixel and y position of the lightposition
+    float dz = normPos.z - lightPosition.z; // Calculates the difference between the z position of the pixel and z position of the lightposition
+
+
+    float squaredDistance = dx * dx + dy * dy + dz * dz; // Uses the pythagorous thereom to calculate the distance bewteen the lightposition and the pixel position, squared
+    float maxDistance = 50.0f;
+    float clampedDistance = glm::clamp(squaredDistance, 1.0f, maxDistance * maxDistance); // Clamps the distance between 1 and 50, the square root is never needed
+
+
+    // Smoother falloff for distance attenuation (inverse-square law approximation)
+    float distanceIntensity = 1.0f / clampedDistance;
+
+
+    // Combine the two factors
+    float intensity = angleIntensity * distanceIntensity;
+
+
+    // Choose character based on intensity
+    return static_cast<char>(glyphTable.glyphs[glyphLevel(intensity)]);
+}
+
+
+// Edge function of the edge going from a to b, evaluated at p. It is twice the signed area of the triangle (a, b, p),
+// so it is positive when p is on the inner side of the edge of a counter clockwise triangle and zero when p is on the edge
+inline int edgeFunction(int ax, int ay, int bx, int by, int px, int py) {
+    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+
+// SIMD pixel kernel. The edge function rasterizer hands it simdWidth cells of a row at a time and it does the coverage test,
+// the depth test, the depth write and the character selection for all of them at once. Without SSE4.1 or AVX2 the
+// width is 1 and the rasterizer only uses its scalar loop
+#if GLM_ARCH & GLM_ARCH_AVX2_BIT
+const int simdWidth = 8;
+typedef __m256 simdFloat;
+typedef __m256i simdInt;
+
+inline simdFloat simdSet(float v) { return _mm256_set1_ps(v); }
+inline simdInt simdSet(int v) { return _mm256_set1_epi32(v); }
+inline simdFloat simdAdd(simdFloat a, simdFloat b) { return _mm256_add_ps(a, b); }
+inline simdFloat simdSub(simdFloat a, simdFloat b) { return _mm256_sub_ps(a, b); }
+inline simdFloat simdMul(simdFloat a, simdFloat b) { return _mm256_mul_ps(a, b); }
+inline simdFloat simdDiv(simdFloat a, simdFloat b) { return _mm256_div_ps(a, b); }
+inline simdFloat simdSqrt(simdFloat a) { return _mm256_sqrt_ps(a); }
+inline simdFloat simdClamp(simdFloat v, simdFloat minVal, simdFloat maxVal) { return _mm256_max_ps(_mm256_min_ps(v, maxVal), minVal); }
+inline simdInt simdLess(simdFloat a, simdFloat b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+inline simdInt simdGreater(simdFloat a, simdFloat b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_GT_OQ)); }
+inline simdInt simdAdd(simdInt a, simdInt b) { return _mm256_add_epi32(a, b); }
+inline simdInt simdMul(simdInt a, simdInt b) { return _mm256_mullo_epi32(a, b); }
+inline simdInt simdAnd(simdInt a, simdInt b) { return _mm256_and_si256(a, b); }
+inline simdInt simdOr(simdInt a, simdInt b) { return _mm256_or_si256(a, b); }
+inline simdInt simdNotNegative(simdInt a) { return _mm256_cmpgt_epi32(a, _mm256_set1_epi32(-1)); }
+inline simdInt simdSelect(simdInt a, simdInt b, simdInt mask) { return _mm256_blendv_epi8(a, b, mask); }
+inline bool simdAny(simdInt mask) { return !_mm256_testz_si256(mask, mask); }
+inline int simdMoveMask(simdInt mask) { return _mm256_movemask_ps(_mm256_castsi256_ps(mask)); }
+inline simdInt simdLaneIndex() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+inline simdFloat simdToFloat(simdInt a) { return _mm256_cvtepi32_ps(a); }
+inline simdFloat simdLoad(const float* v) { return _mm256_loadu_ps(v); }
+inline simdInt simdLoad(const int* v) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v)); }
+inline simdInt simdLookup(const int* table, simdInt index) { return _mm256_i32gather_epi32(table, index, 4); }
+
+inline simdInt simdGreater(simdInt a, simdInt b) { return _mm256_cmpgt_epi32(a, b); }
+inline simdInt simdGreaterUnsigned(simdInt a, simdInt b) { return simdGreater(_mm256_xor_si256(a, _mm256_set1_epi32(INT32_MIN)), _mm256_xor_si256(b, _mm256_set1_epi32(INT32_MIN))); }
+inline simdInt simdShiftLeft(simdInt a, int bits) { return _mm256_slli_epi32(a, bits); }
+inline simdInt simdTruncate(simdFloat a) { return _mm256_cvttps_epi32(a); }
+inline simdFloat simdFloor(simdFloat a) { return _mm256_floor_ps(a); }
+inline void simdStore(float* v, simdFloat a) { _mm256_storeu_ps(v, a); }
+inline void simdStore(int* v, simdInt a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(v), a); }
+
+// Transposes the lanes into simdWidth screen vertices. The unpacks and shuffles transpose each 128 bit half on its own,
+// which leaves vertices 0 and 4, 1 and 5 and so on sharing a register until the permutes put them back in order
+inline void simdStoreScreenVertices(ScreenVertex* out, simdInt x, simdInt y, simdFloat z, simdInt clipCodes) {
+    __m256 xy0 = _mm256_unpacklo_ps(_mm256_castsi256_ps(x), _mm256_castsi256_ps(y)), xy1 = _mm256_unpackhi_ps(_mm256_castsi256_ps(x), _mm256_castsi256_ps(y));
+    __m256 zc0 = _mm256_unpacklo_ps(z, _mm256_castsi256_ps(clipCodes)), zc1 = _mm256_unpackhi_ps(z, _mm256_castsi256_ps(clipCodes));
+    __m256 v04 = _mm256_shuffle_ps(xy0, zc0, _MM_SHUFFLE(1, 0, 1, 0)), v15 = _mm256_shuffle_ps(xy0, zc0, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 v26 = _mm256_shuffle_ps(xy1, zc1, _MM_SHUFFLE(1, 0, 1, 0)), v37 = _mm256_shuffle_ps(xy1, zc1, _MM_SHUFFLE(3, 2, 3, 2));
+    float* dest = reinterpret_cast<float*>(out);
+    _mm256_storeu_ps(dest, _mm256_permute2f128_ps(v04, v15, 0x20));
+    _mm256_storeu_ps(dest + 8, _mm256_permute2f128_ps(v26, v37, 0x20));
+    _mm256_storeu_ps(dest + 16, _mm256_permute2f128_ps(v04, v15, 0x31));
+    _mm256_storeu_ps(dest + 24, _mm256_permute2f128_ps(v26, v37, 0x31));
+}
+
+// Loads simdWidth depths in each of the depth formats, the integer formats are widened to 32 bits
+inline simdFloat simdLoadDepth(const float* depth) { return _mm256_loadu_ps(depth); }
+inline simdInt simdLoadDepth(const uint32_t* depth) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(depth)); }
+inline simdInt simdLoadDepth(const uint16_t* depth) { return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(depth))); }
+
+// Writes the depths of the lanes set in mask back to the depth buffer and leaves the others untouched
+inline void simdStoreDepth(float* depth, simdFloat value, simdInt mask) {
+    _mm256_storeu_ps(depth, _mm256_blendv_ps(_mm256_loadu_ps(depth), value, _mm256_castsi256_ps(mask)));
+}
+inline void simdStoreDepth(uint32_t* depth, simdInt value, simdInt mask) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(depth), _mm256_blendv_epi8(simdLoadDepth(depth), value, mask));
+}
+inline void simdStoreDepth(uint16_t* depth, simdInt value, simdInt mask) {
+    simdInt blended = _mm256_blendv_epi8(simdLoadDepth(depth), value, mask);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(depth), _mm_packus_epi32(_mm256_castsi256_si128(blended), _mm256_extracti128_si256(blended, 1)));
+}
+
+// Narrows the lanes down to one byte each and writes the characters of the lanes set in mask to the grid
+inline void simdStoreChars(char* row, simdInt chars, simdInt mask) {
+    __m128i chars16 = _mm_packs_epi32(_mm256_castsi256_si128(chars), _mm256_extracti128_si256(chars, 1));
+    __m128i mask16 = _mm_packs_epi32(_mm256_castsi256_si128(mask), _mm256_extracti128_si256(mask, 1));
+    __m128i old = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row));
+    __m128i blended = _mm_blendv_epi8(old, _mm_packus_epi16(chars16, chars16), _mm_packs_epi16(mask16, mask16));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(row), blended);
+}
+#elif GLM_ARCH & GLM_ARCH_SSE41_BIT
+const int simdWidth = 4;
+typedef glm_f32vec4 simdFloat;
+typedef glm_i32vec4 simdInt;
+
+inline simdFloat simdSet(float v) { return _mm_set1_ps(v); }
+inline simdInt simdSet(int v) { return _mm_set1_epi32(v); }
+inline simdFloat simdAdd(simdFloat a, simdFloat b) { return glm_vec4_add(a, b); }
+inline simdFloat simdSub(simdFloat a, simdFloat b) { return glm_vec4_sub(a, b); }
+inline simdFloat simdMul(simdFloat a, simdFloat b) { return glm_vec4_mul(a, b); }
+inline simdFloat simdDiv(simdFloat a, simdFloat b) { return glm_vec4_div(a, b); }
+inline simdFloat simdSqrt(simdFloat a) { return _mm_sqrt_ps(a); }
+inline simdFloat simdClamp(simdFloat v, simdFloat minVal, simdFloat maxVal) { return glm_vec4_clamp(v, minVal, maxVal); }
+inline simdInt simdLess(simdFloat a, simdFloat b) { return _mm_castps_si128(_mm_cmplt_ps(a, b)); }
+inline simdInt simdGreater(simdFloat a, simdFloat b) { return _mm_castps_si128(_mm_cmpgt_ps(a, b)); }
+inline simdInt simdAdd(simdInt a, simdInt b) { return _mm_add_epi32(a, b); }
+inline simdInt simdMul(simdInt a, simdInt b) { return _mm_mullo_epi32(a, b); }
+inline simdInt simdAnd(simdInt a, simdInt b) { return _mm_and_si128(a, b); }
+inline simdInt simdOr(simdInt a, simdInt b) { return _mm_or_si128(a, b); }
+inline simdInt simdNotNegative(simdInt a) { return _mm_cmpgt_epi32(a, _mm_set1_epi32(-1)); }
+inline simdInt simdSelect(simdInt a, simdInt b, simdInt mask) { return _mm_blendv_epi8(a, b, mask); }
+inline bool simdAny(simdInt mask) { return !_mm_testz_si128(mask, mask); }
+inline int simdMoveMask(simdInt mask) { return _mm_movemask_ps(_mm_castsi128_ps(mask)); }
+inline simdInt simdLaneIndex() { return _mm_setr_epi32(0, 1, 2, 3); }
+inline simdFloat simdToFloat(simdInt a) { return _mm_cvtepi32_ps(a); }
+inline simdFloat simdLoad(const float* v) { return _mm_loadu_ps(v); }
+inline simdInt simdLoad(const int* v) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(v)); }
+inline simdInt simdLookup(const int* table, simdInt index) {
+    return _mm_setr_epi32(table[_mm_extract_epi32(index, 0)], table[_mm_extract_epi32(index, 1)], table[_mm_extract_epi32(index, 2)], table[_mm_extract_epi32(index, 3)]);
+}
+
+inline simdInt simdGreater(simdInt a, simdInt b) { return _mm_cmpgt_epi32(a, b); }
+inline simdInt simdGreaterUnsigned(simdInt a, simdInt b) { return simdGreater(_mm_xor_si128(a, _mm_set1_epi32(INT32_MIN)), _mm_xor_si128(b, _mm_set1_epi32(INT32_MIN))); }
+inline simdInt simdShiftLeft(simdInt a, int bits) { return _mm_slli_epi32(a, bits); }
+inline simdInt simdTruncate(simdFloat a) { return _mm_cvttps_epi32(a); }
+inline simdFloat simdFloor(simdFloat a) { return _mm_floor_ps(a); }
+inline void simdStore(float* v, simdFloat a) { _mm_storeu_ps(v, a); }
+inline void simdStore(int* v, simdInt a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(v), a); }
+
+// Transposes the lanes into simdWidth screen vertices
+inline void simdStoreScreenVertices(ScreenVertex* out, simdInt x, simdInt y, simdFloat z, simdInt clipCodes) {
+    __m128 v0 = _mm_castsi128_ps(x), v1 = _mm_castsi128_ps(y), v2 = z, v3 = _mm_castsi128_ps(clipCodes);
+    _MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+    float* dest = reinterpret_cast<float*>(out);
+    _mm_store_ps(dest, v0);
+    _mm_store_ps(dest + 4, v1);
+    _mm_store_ps(dest + 8, v2);
+    _mm_store_ps(dest + 12, v3);
+}
+
+// Loads simdWidth depths in each of the depth formats, the integer formats are widened to 32 bits
+inline simdFloat simdLoadDepth(const float* depth) { return _mm_loadu_ps(depth); }
+inline simdInt simdLoadDepth(const uint32_t* depth) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(depth)); }
+inline simdInt simdLoadDepth(const uint16_t* depth) { return _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(depth))); }
+
+// Writes the depths of the lanes set in mask back to the depth buffer and leaves the others untouched
+inline void simdStoreDepth(float* depth, simdFloat value, simdInt mask) {
+    _mm_storeu_ps(depth, _mm_blendv_ps(_mm_loadu_ps(depth), value, _mm_castsi128_ps(mask)));
+}
+inline void simdStoreDepth(uint32_t* depth, simdInt value, simdInt mask) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(depth), _mm_blendv_epi8(simdLoadDepth(depth), value, mask));
+}
+inline void simdStoreDepth(uint16_t* depth, simdInt value, simdInt mask) {
+    simdInt blended = _mm_blendv_epi8(simdLoadDepth(depth), value, mask);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(depth), _mm_packus_epi32(blended, blended));
+}
+
+// Narrows the lanes down to one byte each and writes the characters of the lanes set in mask to the grid
+inline void simdStoreChars(char* row, simdInt chars, simdInt mask) {
+    __m128i chars16 = _mm_packs_epi32(chars, chars);
+    __m128i mask16 = _mm_packs_epi32(mask, mask);
+    int oldChars;
+    std::memcpy(&oldChars, row, sizeof(oldChars));
+    __m128i blended = _mm_blendv_epi8(_mm_cvtsi32_si128(oldChars), _mm_packus_epi16(chars16, chars16), _mm_packs_epi16(mask16, mask16));
+    int newChars = _mm_cvtsi128_si32(blended);
+    std::memcpy(row, &newChars, sizeof(newChars));
+}
+#else
+const int simdWidth = 1;
+#endif
+
+
+// Every depth format stores reversed depth, 1 at the near plane and 0 at the far plane, so a nearer cell has the
+// greater value and the buffer is cleared to 0. For float32 this puts the far away depths, where the perspective divide
+// packs them closest together, near 0 where floats have the most precision
+template <DepthFormat format>
+struct DepthTraits;
+
+
+template <>
+struct DepthTraits<DepthFormat::Float32>
+{
+    typedef float Type;
+    static constexpr bool packsGlyph = false;
+    static constexpr Type clearValue = 0.0f;
+    static Type* buffer() { return &zBuffer.float32[0][0]; }
+    static Type encode(float z) { return 0.5f - 0.5f * z; }
+#if GLM_ARCH & (GLM_ARCH_AVX2_BIT | GLM_ARCH_SSE41_BIT)
+    static simdFloat encode(simdFloat z) { return simdSub(simdSet(0.5f), simdMul(simdSet(0.5f), z)); }
+    static simdInt closer(simdFloat a, simdFloat b) { return simdGreater(a, b); }
+#endif
+};
+
+
+// The unsigned normalized formats scale the reversed depth to the largest integer that fits in their bits
+template <typename T, int bits>
+struct UnormDepthTraits
+{
+    typedef T Type;
+    static constexpr bool packsGlyph = false;
+    static constexpr Type clearValue = 0;
+    static constexpr float scale = static_cast<float>((1u << bits) - 1);
+    static Type encode(float z) { return static_cast<Type>(glm::clamp(0.5f - 0.5f * z, 0.0f, 1.0f) * scale + 0.5f); }
+#if GLM_ARCH & (GLM_ARCH_AVX2_BIT | GLM_ARCH_SSE41_BIT)
+    static simdInt encode(simdFloat z) {
+        simdFloat depth = simdClamp(simdSub(simdSet(0.5f), simdMul(simdSet(0.5f), z)), simdSet(0.0f), simdSet(1.0f));
+        return simdTruncate(simdAdd(simdMul(depth, simdSet(scale)), simdSet(0.5f)));
+    }
+    static simdInt closer(simdInt a, simdInt b) { return simdGreater(a, b); } // Both are widened to 32 bits and below 2^24, so a signed compare works
+#endif
+};
+
+
+template <>
+struct DepthTraits<DepthFormat::Unorm24> : UnormDepthTraits<uint32_t, 24>
+{
+    static Type* buffer() { return &zBuffer.unorm24[0][0]; }
+};
+
+
+template <>
+struct DepthTraits<DepthFormat::Unorm16> : UnormDepthTraits<uint16_t, 16>
+{
+    static Type* buffer() { return &zBuffer.unorm16[0][0]; }
+};
+
+
+// Depth and character in one word. The depth is shifted into the high 24 bits and the low 8 bits of an encoded depth
+// are left empty for the character, so comparing an encoded depth with a stored word compares just the depths, and a
+// cell that passes is written with a single store. Because the whole test is one compare on one word it could also be
+// done with an atomic max (reversed depth) when several threads draw into the same cells
+template <>
+struct DepthTraits<DepthFormat::Packed24>
+{
+    typedef uint32_t Type;
+    static constexpr bool packsGlyph = true;
+    static constexpr Type clearValue = ' '; // Depth 0 and an empty cell
+    static Type* buffer() { return &zBuffer.packed24[0][0]; }
+    static Type encode(float z) { return DepthTraits<DepthFormat::Unorm24>::encode(z) << 8; }
+#if GLM_ARCH & (GLM_ARCH_AVX2_BIT | GLM_ARCH_SSE41_BIT)
+    static simdInt encode(simdFloat z) { return simdShiftLeft(DepthTraits<DepthFormat::Unorm24>::encode(z), 8); }
+    static simdInt closer(simdInt a, simdInt b) { return simdGreaterUnsigned(a, b); }
+#endif
+};
+
+
+// Stores a cell that passed the depth test, the packed format puts the character into the same word as the depth
+template <DepthFormat format>
+inline void writeCell(typename DepthTraits<format>::Type& depth, char& cell, typename DepthTraits<format>::Type cellDepth, char glyph) {
+    if constexpr (DepthTraits<format>::packsGlyph)
+    {
+        depth = cellDepth | static_cast<unsigned char>(glyph);
+    }
+    else
+    {
+        depth = cellDepth;
+        cell = glyph;
+    }
+}
+
+
+template <DepthFormat format>
+void fillTriangle(const ScreenTriangle& triangle) {
+    const ScreenVertex& p1 = triangle.v[0], & p2 = triangle.v[1], & p3 = triangle.v[2];
+
+
+    // The scanline rasterizer works in whole cells, so the sub pixel part of the positions is dropped
+    int x1 = p1.x >> subPixelBits, y1 = p1.y >> subPixelBits; // Assigns x1 and y1 into p1
+    int x2 = p2.x >> subPixelBits, y2 = p2.y >> subPixelBits; // Assigns x2 and y2 into p2
+    int x3 = p3.x >> subPixelBits, y3 = p3.y >> subPixelBits; // Assigns x3 and y3 into p3
+
+
+    float z1 = p1.z, z2 = p2.z, z3 = p3.z; // Assigns z1 into p1, z2 into p2 and z3 into p3
+
+
+    // Sort vertices by y-coordinate (y1 <= y2 <= y3)
+    if (y2 < y1)
+    {
+        std::swap(y1, y2); std::swap(x1, x2); std::swap(z1, z2);
+    }
+
+
+    if (y3 < y1)
+    {
+        std::swap(y1, y3); std::swap(x1, x3); std::swap(z1, z3);
+    }
+   
+    if (y3 < y2)
+    {
+        std::swap(y2, y3); std::swap(x2, x3); std::swap(z2, z3);
+    }
+
+
+    glm::vec3 point1 = glm::vec3(static_cast<float>(x1), static_cast<float>(y1), z1); // Establishes point1
+    glm::vec3 point2 = glm::vec3(static_cast<float>(x2), static_cast<float>(y2), z2); // Establishes point2
+    glm::vec3 point3 = glm::vec3(static_cast<float>(x3), static_cast<float>(y3), z3); // Establishes point3
+
+
+    // Interpolation helper
+    auto interpolate = [](int y, int y0, int y1, int x0, int x1, float z0, float z1) -> std::tuple<int, float> {
+        if (y1 == y0) return {x0, z0}; // Checks if y1 = y0 and if it is, we already know that x1 will be equal to x0 and z1 will be equal to z0
+        float t = static_cast<float>(y - y0) / (y1 - y0); // Finds the interpolation factor which changes y
+        int x = static_cast<int>(x0 + t * (x1 - x0)); // Uses t to interpolate x
+        float z = z0 + t * (z1 - z0); // Uses t to interpolate y
+        return {x, z};
+    };
+
+
+    float angleIntensity = calculateAngleIntensity(point1, point2, point3);
+    typename DepthTraits<format>::Type* depth = DepthTraits<format>::buffer();
+
+
+    // Iterates over every y cooridinate from y1 to y2 which is the upper segment of the triangle
+    for (int y = std::max(y1, 0); y <= std::min(y2, gridHeight - 1); y++) {
+        auto [xa, za] = interpolate(y, y1, y3, x1, x3, z1, z3); // Finds the x and z cooridinates on the left side of the trinagle by using the interpolated value based on the y cooridinate
+        auto [xb, zb] = interpolate(y, y1, y2, x1, x2, z1, z2); // Finds the x and z cooridinates on the right side of the trinagle by using the interpolated value based on the y cooridinate
+
+
+        if (xa > xb)
+        {
+            std::swap(xa, xb); std::swap(za, zb);
+        }
+
+
+        // Iterates over x cooridinate between the x cooridinate on the left side to the x cooridinate on the right side
+        for (int x = std::max(xa, 0); x <= std::min(xb, gridWidth - 1); x++) {
+            float z = za + (zb - za) * (static_cast<float>(x - xa) / (xb - xa + 1e-6f)); // Calculates z by interpolating the difference between the left to the right side of the triangle based on the x cooridinates
+            if (x >= 0 && x < gridWidth && y >= 0 && y < gridHeight && DepthTraits<format>::encode(z) > depth[y * gridPitch + x])  // Checks if the cooridnates are inbounds
+            {
+                // Sets the new zBuffer and the pixels in that position to the assigned colour
+                writeCell<format>(depth[y * gridPitch + x], grid[y][x], DepthTraits<format>::encode(z), shadePixel(x, y, z, angleIntensity));
+            }
+        }
+    }
+
+
+    // Lower part of triangle
+    for (int y = std::max(y2, 0); y <= std::min(y3, gridHeight - 1); y++) {
+        auto [xa, za] = interpolate(y, y1, y3, x1, x3, z1, z3); // Finds the x and z cooridinates on the left side of the trinagle by using the interpolated value based on the y cooridinate
+        auto [xb, zb] = interpolate(y, y2, y3, x2, x3, z2, z3); // Finds the x and z cooridinates on the right side of the trinagle by using the interpolated value based on the y cooridinate
+       
+        if (xa > xb)
+        {
+            std::swap(xa, xb); std::swap(za, zb);
+        }
+
+
+        // Iterates over x cooridinate between the x cooridinate on the left side to the x cooridinate on the right side
+        for (int x = std::max(xa, 0); x <= std::min(xb, gridWidth - 1); x++) {
+            float z = za + (zb - za) * (static_cast<float>(x - xa) / (xb - xa + 1e-6f));
+            if (x >= 0 && x < gridWidth && y >= 0 && y < gridHeight && DepthTraits<format>::encode(z) > depth[y * gridPitch + x])
+            {
+                writeCell<format>(depth[y * gridPitch + x], grid[y][x], DepthTraits<format>::encode(z), shadePixel(x, y, z, angleIntensity));
+            }
+        }
+    }
+}
+
+
+#if GLM_ARCH & (GLM_ARCH_AVX2_BIT | GLM_ARCH_SSE41_BIT)
+// Per triangle constants of the SIMD kernel, the lane offsets only have to be multiplied out once per triangle
+struct SimdTriangle
+{
+    simdInt stepX1, stepX2, stepX3; // How much each edge function changes from the first lane to each of the others
+    simdFloat stepZX;               // How much the depth changes from the first lane to each of the others
+    simdFloat angleIntensity;
+    simdInt id;
+};
+
+
+// Same lighting as shadePixel for the simdWidth cells starting at (x, y), returns the character of every lane
+inline simdInt simdShadeCells(int x, int y, simdFloat cellZ, simdFloat angleIntensity) {
+    // Normalizes the position of every cell and finds its distance to the light
+    simdFloat posX = simdMul(simdAdd(simdSet(static_cast<float>(x)), simdToFloat(simdLaneIndex())), simdSet(cellWidth));
+    simdFloat posY = simdSet(y * cellHeight);
+    simdFloat length = simdSqrt(simdAdd(simdAdd(simdMul(posX, posX), simdMul(posY, posY)), simdMul(cellZ, cellZ)));
+    simdFloat dx = simdSub(simdDiv(posX, length), simdSet(lightPosition.x));
+    simdFloat dy = simdSub(simdDiv(posY, length), simdSet(lightPosition.y));
+    simdFloat dz = simdSub(simdDiv(cellZ, length), simdSet(lightPosition.z));
+    simdFloat squaredDistance = simdAdd(simdAdd(simdMul(dx, dx), simdMul(dy, dy)), simdMul(dz, dz));
+    simdFloat clampedDistance = simdClamp(squaredDistance, simdSet(1.0f), simdSet(50.0f * 50.0f));
+    simdFloat distanceIntensity = simdDiv(simdSet(1.0f), clampedDistance);
+    simdFloat intensity = simdMul(angleIntensity, distanceIntensity);
+
+
+    // Choose character based on intensity, same rounding as glyphLevel
+    simdFloat level = simdMul(simdClamp(intensity, simdSet(0.0f), simdSet(1.0f)), simdSet(static_cast<float>(glyphLevels - 1)));
+    return simdLookup(glyphTable.glyphs, simdTruncate(simdAdd(level, simdSet(0.5f))));
+}
+
+
+// Does the work of the scalar loop in rasterizeEdgeTriangle for the simdWidth cells starting at (x, y), chars, depth
+// and ids point at the first of them. Returns true if any of the cells was written
+template <DepthFormat format, bool depthTest, bool visibility>
+inline bool shadeCellsSimd(const SimdTriangle& tri, char* chars, typename DepthTraits<format>::Type* depth, uint32_t* ids, int x, int y, int w1, int w2, int w3, float z) {
+    // Coverage, all three edge functions must be positive for the cell to be inside the triangle
+    simdInt e1 = simdAdd(simdSet(w1), tri.stepX1);
+    simdInt e2 = simdAdd(simdSet(w2), tri.stepX2);
+    simdInt e3 = simdAdd(simdSet(w3), tri.stepX3);
+    simdInt mask = simdNotNegative(simdOr(simdOr(e1, e2), e3));
+    if (!simdAny(mask))
+    {
+        return false;
+    }
+
+
+    // Depth test, skipped when the whole triangle is known to be in front of everything under it
+    simdFloat cellZ = simdAdd(simdSet(z), tri.stepZX);
+    auto cellDepth = DepthTraits<format>::encode(cellZ);
+    if (depthTest)
+    {
+        mask = simdAnd(mask, DepthTraits<format>::closer(cellDepth, simdLoadDepth(depth)));
+        if (!simdAny(mask))
+        {
+            return false;
+        }
+    }
+
+
+    // The visibility buffer only keeps the depth and who drew the cell, the IDs are 32 bit words like the unorm24 depths
+    if constexpr (visibility)
+    {
+        simdStoreDepth(depth, cellDepth, mask);
+        simdStoreDepth(ids, tri.id, mask);
+        return true;
+    }
+
+
+    simdInt glyphs = simdShadeCells(x, y, cellZ, tri.angleIntensity);
+    if constexpr (DepthTraits<format>::packsGlyph)
+    {
+        simdStoreDepth(depth, simdOr(cellDepth, glyphs), mask);
+    }
+    else
+    {
+        simdStoreDepth(depth, cellDepth, mask);
+        simdStoreChars(chars, glyphs, mask);
+    }
+    return true;
+}
+#endif
+
+
+// Checks if an edge is a top or left edge of a counter clockwise triangle from how its edge function changes over the screen
+inline bool isTopLeftEdge(int stepX, int stepY) {
+    return stepX > 0 || (stepX == 0 && stepY > 0);
+}
+
+
+// A rectangle of cells the rasterizers draw into, either the whole grid or the private buffers of one tile
+struct RenderTarget
+{
+    char* chars;                // Character of the cell at (minX, minY)
+    void* depth;                // Depth of the cell at (minX, minY), in the depth format being drawn with
+    uint32_t* ids;              // Triangle ID of the cell at (minX, minY), only used with the visibility buffer
+    uint8_t* coverage;          // Coverage mask of the cell at (minX, minY), only used with coverage sampling
+    int pitch;                  // Number of cells from one row to the next
+    int minX, minY, maxX, maxY; // Cells covered by the target in grid cooridinates
+};
+
+
+// Everything the edge function rasterizer needs to know about a triangle, worked out once so the triangle can be drawn
+// into several tiles without repeating the setup
+struct EdgeTriangle
+{
+    int minX, minY, maxX, maxY;          // Bounding box in cells, clipped to the grid
+    int coverMinX, coverMinY;            // Bounding box of the cells with a coverage sample that can be inside the triangle,
+    int coverMaxX, coverMaxY;            // the same as the bounding box when coverageSampling is off
+    int w1, w2, w3;                      // Edge functions at the center of cell (minX, minY) with the fill rule bias applied
+    int stepX1, stepX2, stepX3;          // How much each edge function changes when moving one cell right
+    int stepY1, stepY2, stepY3;          // How much each edge function changes when moving one cell down
+    float z, stepZX, stepZY;             // Depth at the center of cell (minX, minY) and how much it changes per cell
+    float minZ, maxZ;                    // Nearest and farthest depth of the three corners
+    float angleIntensity;
+    uint32_t id;                         // Index into frameTriangles, what the visibility buffer stores for the cells it covers
+};
+
+
+// Half-space rasterizer. Instead of walking the two halves of the triangle line by line it visits every cell in the
+// triangle's bounding box and checks which side of the three edges the cell's center is on. The edge functions and the
+// depth are linear over the screen, so moving one cell only adds a constant to them and there is no division inside the
+// loops. Positions are in sub pixel fixed point and the top-left fill rule decides who owns a center lying exactly on an
+// edge, so two triangles sharing an edge never both draw the same cell.
+// This part does the per triangle setup and returns false when the triangle covers no cells at all
+bool setupEdgeTriangle(const ScreenTriangle& triangle, EdgeTriangle& tri) {
+    const ScreenVertex& p1 = triangle.v[0], & p2 = triangle.v[1], & p3 = triangle.v[2];
+    int x1 = p1.x, y1 = p1.y; // Assigns x1 and y1 into p1
+    int x2 = p2.x, y2 = p2.y; // Assigns x2 and y2 into p2
+    int x3 = p3.x, y3 = p3.y; // Assigns x3 and y3 into p3
+    float z1 = p1.z, z2 = p2.z, z3 = p3.z; // Assigns z1 into p1, z2 into p2 and z3 into p3
+
+
+    // Twice the signed area of the triangle, zero means the triangle is seen edge on and covers nothing
+    int area = edgeFunction(x1, y1, x2, y2, x3, y3);
+    if (area == 0)
+    {
+        return false;
+    }
+
+
+    // Make the triangle counter clockwise so the inside is where all three edge functions are positive
+    if (area < 0)
+    {
+        std::swap(x2, x3); std::swap(y2, y3); std::swap(z2, z3);
+        area = -area;
+    }
+
+
+    // Bounding box of the cells whose centers can be inside the triangle, clipped to the grid so no bounds checks are needed per pixel
+    tri.minX = std::max((std::min({x1, x2, x3}) - subPixelHalf + subPixelScale - 1) >> subPixelBits, 0);
+    tri.maxX = std::min((std::max({x1, x2, x3}) - subPixelHalf) >> subPixelBits, gridWidth - 1);
+    tri.minY = std::max((std::min({y1, y2, y3}) - subPixelHalf + subPixelScale - 1) >> subPixelBits, 0);
+    tri.maxY = std::min((std::max({y1, y2, y3}) - subPixelHalf) >> subPixelBits, gridHeight - 1);
+
+
+    // The coverage samples reach further out than the centers, so a triangle can cover samples of cells around its
+    // bounding box and still be worth drawing when it covers no center at all
+    if (coverageSampling)
+    {
+        tri.coverMinX = std::max((std::min({x1, x2, x3}) - coverageSampleX[1] + subPixelScale - 1) >> subPixelBits, 0);
+        tri.coverMaxX = std::min((std::max({x1, x2, x3}) - coverageSampleX[0]) >> subPixelBits, gridWidth - 1);
+        tri.coverMinY = std::max((std::min({y1, y2, y3}) - coverageSampleY[3] + subPixelScale - 1) >> subPixelBits, 0);
+        tri.coverMaxY = std::min((std::max({y1, y2, y3}) - coverageSampleY[0]) >> subPixelBits, gridHeight - 1);
+    }
+    else
+    {
+        tri.coverMinX = tri.minX; tri.coverMaxX = tri.maxX;
+        tri.coverMinY = tri.minY; tri.coverMaxY = tri.maxY;
+    }
+    if (tri.coverMinX > tri.coverMaxX || tri.coverMinY > tri.coverMaxY)
+    {
+        return false;
+    }
+
+
+    const float toCells = 1.0f / subPixelScale;
+    glm::vec3 point1 = glm::vec3(x1 * toCells, y1 * toCells, z1); // Establishes point1
+    glm::vec3 point2 = glm::vec3(x2 * toCells, y2 * toCells, z2); // Establishes point2
+    glm::vec3 point3 = glm::vec3(x3 * toCells, y3 * toCells, z3); // Establishes point3
+    tri.angleIntensity = calculateAngleIntensity(point1, point2, point3);
+    tri.minZ = std::min({z1, z2, z3});
+    tri.maxZ = std::max({z1, z2, z3});
+
+
+    // How much each edge function changes when moving one cell right (stepX) or one cell down (stepY)
+    tri.stepX1 = (y2 - y3) * subPixelScale; tri.stepY1 = (x3 - x2) * subPixelScale; // Edge from point2 to point3, the weight of point1
+    tri.stepX2 = (y3 - y1) * subPixelScale; tri.stepY2 = (x1 - x3) * subPixelScale; // Edge from point3 to point1, the weight of point2
+    tri.stepX3 = (y1 - y2) * subPixelScale; tri.stepY3 = (x2 - x1) * subPixelScale; // Edge from point1 to point2, the weight of point3
+
+
+    // The edge functions divided by the area are the barycentric weights, so depth is a plane with a constant step too
+    float invArea = 1.0f / area;
+    tri.stepZX = (tri.stepX1 * z1 + tri.stepX2 * z2 + tri.stepX3 * z3) * invArea;
+    tri.stepZY = (tri.stepY1 * z1 + tri.stepY2 * z2 + tri.stepY3 * z3) * invArea;
+
+
+    // Edge functions and depth at the center of the top left cell of the bounding box
+    int sampleX = (tri.minX << subPixelBits) + subPixelHalf;
+    int sampleY = (tri.minY << subPixelBits) + subPixelHalf;
+    tri.w1 = edgeFunction(x2, y2, x3, y3, sampleX, sampleY);
+    tri.w2 = edgeFunction(x3, y3, x1, y1, sampleX, sampleY);
+    tri.w3 = edgeFunction(x1, y1, x2, y2, sampleX, sampleY);
+    tri.z = (tri.w1 * z1 + tri.w2 * z2 + tri.w3 * z3) * invArea;
+
+
+    // Top-left fill rule. A center exactly on an edge only belongs to the triangle if the edge is a left edge (the inside
+    // is to its right) or a top edge (horizontal with the inside below it). Every other edge gets a bias of one so its
+    // edge function has to be strictly positive, which is exact because the edge functions are integers
+    tri.w1 -= isTopLeftEdge(tri.stepX1, tri.stepY1) ? 0 : 1;
+    tri.w2 -= isTopLeftEdge(tri.stepX2, tri.stepY2) ? 0 : 1;
+    tri.w3 -= isTopLeftEdge(tri.stepX3, tri.stepY3) ? 0 : 1;
+    return true;
+}
+
+
+// Draws the part of a set up triangle that falls inside the target and returns true if any cell was written. Without
+// depthTest every covered cell is written, which is only correct when the triangle is in front of the whole target.
+// With visibility the cells get the triangle's ID instead of a character
+template <DepthFormat format, bool depthTest, bool visibility>
+bool rasterizeEdgeTriangle(const EdgeTriangle& tri, const RenderTarget& target) {
+    typedef typename DepthTraits<format>::Type DepthType;
+    int minX = std::max(tri.minX, target.minX), maxX = std::min(tri.maxX, target.maxX);
+    int minY = std::max(tri.minY, target.minY), maxY = std::min(tri.maxY, target.maxY);
+    if (minX > maxX || minY > maxY)
+    {
+        return false;
+    }
+    bool written = false;
+
+
+    // Rows start on a multiple of simdWidth from the left of the target so groups of cells never cross into the next
+    // tile. The cells skipped over on the left are outside the bounding box and therefore outside the triangle
+    int startX = minX;
+#if GLM_ARCH & (GLM_ARCH_AVX2_BIT | GLM_ARCH_SSE41_BIT)
+    startX = target.minX + (minX - target.minX) / simdWidth * simdWidth;
+
+
+    SimdTriangle simdTri;
+    simdTri.stepX1 = simdMul(simdLaneIndex(), simdSet(tri.stepX1));
+    simdTri.stepX2 = simdMul(simdLaneIndex(), simdSet(tri.stepX2));
+    simdTri.stepX3 = simdMul(simdLaneIndex(), simdSet(tri.stepX3));
+    simdTri.stepZX = simdMul(simdToFloat(simdLaneIndex()), simdSet(tri.stepZX));
+    simdTri.angleIntensity = simdSet(tri.angleIntensity);
+    simdTri.id = simdSet(static_cast<int>(tri.id));
+#endif
+
+
+    // Edge functions and depth at the center of cell (startX, minY)
+    int dx = startX - tri.minX, dy = minY - tri.minY;
+    int w1Row = tri.w1 + dx * tri.stepX1 + dy * tri.stepY1;
+    int w2Row = tri.w2 + dx * tri.stepX2 + dy * tri.stepY2;
+    int w3Row = tri.w3 + dx * tri.stepX3 + dy * tri.stepY3;
+    float zRow = tri.z + dx * tri.stepZX + dy * tri.stepZY;
+
+
+    for (int y = minY; y <= maxY; y++) {
+        // Shift the row pointers so they can be indexed with grid x cooridinates
+        char* chars = target.chars + (y - target.minY) * target.pitch - target.minX;
+        DepthType* depth = static_cast<DepthType*>(target.depth) + (y - target.minY) * target.pitch - target.minX;
+        uint32_t* ids = target.ids + (y - target.minY) * target.pitch - target.minX;
+
+
+        int w1 = w1Row, w2 = w2Row, w3 = w3Row;
+        float z = zRow;
+        int x = startX;
+
+
+#if GLM_ARCH & (GLM_ARCH_AVX2_BIT | GLM_ARCH_SSE41_BIT)
+        // Whole groups of cells go through the SIMD kernel. Cells past maxX but still in the target are outside the
+        // bounding box and therefore outside the triangle, so the coverage test already masks them out
+        for (; x <= maxX && x + simdWidth <= target.maxX + 1; x += simdWidth) {
+            written |= shadeCellsSimd<format, depthTest, visibility>(simdTri, &chars[x], &depth[x], &ids[x], x, y, w1, w2, w3, z);
+            w1 += tri.stepX1 * simdWidth; w2 += tri.stepX2 * simdWidth; w3 += tri.stepX3 * simdWidth;
+            z += tri.stepZX * simdWidth;
+        }
+#endif
+
+
+        // Scalar loop for the cells at the right edge of the target, or for every cell when there is no SIMD kernel
+        for (; x <= maxX; x++) {
+            // The cell is inside the triangle when none of the edge functions are negative, or in other words when none of their sign bits are set
+            if ((w1 | w2 | w3) >= 0)
+            {
+                DepthType cellDepth = DepthTraits<format>::encode(z);
+                if (!depthTest || cellDepth > depth[x])
+                {
+                    if constexpr (visibility)
+                    {
+                        depth[x] = cellDepth;
+                        ids[x] = tri.id;
+                    }
+                    else
+                    {
+                        // Sets the new zBuffer and the pixels in that position to the assigned colour
+                        writeCell<format>(depth[x], chars[x], cellDepth, shadePixel(x, y, z, tri.angleIntensity));
+                    }
+                    written = true;
+                }
+            }
+
+
+            w1 += tri.stepX1; w2 += tri.stepX2; w3 += tri.stepX3;
+            z += tri.stepZX;
+        }
+
+
+        w1Row += tri.stepY1; w2Row += tri.stepY2; w3Row += tri.stepY3;
+        zRow += tri.stepZY;
+    }
+    return written;
+}
+
+
+// Sets the bits of the coverage samples the triangle covers in the target's coverage masks. It runs for every triangle
+// whether it ends up visible or not, so a mask is the coverage of the whole scene in that cell and is only partial
+// where the scene's silhouette crosses the cell
+void coverEdgeTriangle(const EdgeTriangle& tri, const RenderTarget& target) {
+    int minX = std::max(tri.coverMinX, target.minX), maxX = std::min(tri.coverMaxX, target.maxX);
+    int minY = std::max(tri.coverMinY, target.minY), maxY = std::min(tri.coverMaxY, target.maxY);
+    if (minX > maxX || minY > maxY)
+    {
+        return;
+    }
+
+
+    // How much each edge function changes from the center of a cell to each of its samples. The steps are whole cells in
+    // sub pixel units, so dividing them back down to sub pixels is exact
+    int offset1[coverageSamples], offset2[coverageSamples], offset3[coverageSamples];
+    for (int s = 0; s < coverageSamples; s++) {
+        int sampleX = coverageSampleX[s % 2] - subPixelHalf, sampleY = coverageSampleY[s / 2] - subPixelHalf;
+        offset1[s] = (sampleX * tri.stepX1 + sampleY * tri.stepY1) / subPixelScale;
+        offset2[s] = (sampleX * tri.stepX2 + sampleY * tri.stepY2) / subPixelScale;
+        offset3[s] = (sampleX * tri.stepX3 + sampleY * tri.stepY3) / subPixelScale;
+    }
+
+
+    // With the smallest and largest offsets most cells are found to be fully inside or outside without testing their samples
+    int low1 = *std::min_element(offset1, offset1 + coverageSamples), high1 = *std::max_element(offset1, offset1 + coverageSamples);
+    int low2 = *std::min_element(offset2, offset2 + coverageSamples), high2 = *std::max_element(offset2, offset2 + coverageSamples);
+    int low3 = *std::min_element(offset3, offset3 + coverageSamples), high3 = *std::max_element(offset3, offset3 + coverageSamples);
+
+
+#if GLM_ARCH & (GLM_ARCH_AVX2_BIT | GLM_ARCH_SSE41_BIT)
+    simdInt simdOffset1[coverageSamples / simdWidth], simdOffset2[coverageSamples / simdWidth], simdOffset3[coverageSamples / simdWidth];
+    for (int group = 0; group < coverageSamples / simdWidth; group++) {
+        simdOffset1[group] = simdLoad(&offset1[group * simdWidth]);
+        simdOffset2[group] = simdLoad(&offset2[group * simdWidth]);
+        simdOffset3[group] = simdLoad(&offset3[group * simdWidth]);
+    }
+#endif
+
+
+    // Edge functions at the center of cell (minX, minY)
+    int dx = minX - tri.minX, dy = minY - tri.minY;
+    int w1Row = tri.w1 + dx * tri.stepX1 + dy * tri.stepY1;
+    int w2Row = tri.w2 + dx * tri.stepX2 + dy * tri.stepY2;
+    int w3Row = tri.w3 + dx * tri.stepX3 + dy * tri.stepY3;
+
+
+    for (int y = minY; y <= maxY; y++) {
+        uint8_t* masks = target.coverage + (y - target.minY) * target.pitch - target.minX;
+        int w1 = w1Row, w2 = w2Row, w3 = w3Row;
+
+
+        for (int x = minX; x <= maxX; x++) {
+            if (w1 + low1 >= 0 && w2 + low2 >= 0 && w3 + low3 >= 0)
+            {
+                masks[x] = fullCoverage;
+            }
+            else if (w1 + high1 >= 0 && w2 + high2 >= 0 && w3 + high3 >= 0)
+            {
+                // The cell is crossed by an edge, test every sample
+                int mask = 0;
+#if GLM_ARCH & (GLM_ARCH_AVX2_BIT | GLM_ARCH_SSE41_BIT)
+                for (int group = 0; group < coverageSamples / simdWidth; group++) {
+                    simdInt e1 = simdAdd(simdSet(w1), simdOffset1[group]);
+                    simdInt e2 = simdAdd(simdSet(w2), simdOffset2[group]);
+                    simdInt e3 = simdAdd(simdSet(w3), simdOffset3[group]);
+                    mask |= simdMoveMask(simdNotNegative(simdOr(simdOr(e1, e2), e3))) << (group * simdWidth);
+                }
+#else
+                for (int s = 0; s < coverageSamples; s++) {
+                    mask |= (((w1 + offset1[s]) | (w2 + offset2[s]) | (w3 + offset3[s])) >= 0) ? 1 << s : 0;
+                }
+#endif
+                masks[x] |= static_cast<uint8_t>(mask);
+            }
+
+
+            w1 += tri.stepX1; w2 += tri.stepX2; w3 += tri.stepX3;
+        }
+
+
+        w1Row += tri.stepY1; w2Row += tri.stepY2; w3Row += tri.stepY3;
+    }
+}
+
+
+// Shapes a partly covered cell can be drawn as, with the samples covered by each shape from the top row down
+struct CoverageShape
+{
+    const char* rows[4];
+    char glyph;
+};
+
+
+const CoverageShape coverageShapes[] = {
+    { { "..", "..", "..", "##" }, '_' },
+    { { "..", "..", "##", "##" }, '_' },
+    { { "##", "..", "..", ".." }, '\'' },
+    { { "##", "##", "..", ".." }, '\'' },
+    { { "..", "##", "##", ".." }, '-' },
+    { { "#.", "#.", "#.", "#." }, '|' },
+    { { ".#", ".#", ".#", ".#" }, '|' },
+    { { "..", ".#", ".#", "##" }, '/' },
+    { { "##", "#.", "#.", ".." }, '/' },
+    { { "..", "#.", "#.", "##" }, '\\' },
+    { { "##", ".#", ".#", ".." }, '\\' },
+};
+
+
+// Coverage mask to character lookup table, every mask gets the shape with the fewest samples that differ from it
+struct CoverageGlyphTable
+{
+    char glyphs[1 << coverageSamples];
+};
+
+
+CoverageGlyphTable buildCoverageGlyphTable() {
+    CoverageGlyphTable table;
+    for (int mask = 0; mask < (1 << coverageSamples); mask++) {
+        int fewestDifferences = coverageSamples + 1;
+        for (const CoverageShape& shape : coverageShapes) {
+            int differences = 0;
+            for (int s = 0; s < coverageSamples; s++) {
+                bool covered = shape.rows[s / 2][s % 2] == '#';
+                differences += (covered != (((mask >> s) & 1) != 0)) ? 1 : 0;
+            }
+            if (differences < fewestDifferences)
+            {
+                fewestDifferences = differences;
+                table.glyphs[mask] = shape.glyph;
+            }
+        }
+    }
+    return table;
+}
+const CoverageGlyphTable coverageGlyphTable = buildCoverageGlyphTable();
+
+
+// Draws the partly covered cells with the character of their shape, empty and fully covered cells are left alone
+void resolveCoverage(const uint8_t* masks, char* chars, int count) {
+    for (int i = 0; i < count; i++) {
+        if (masks[i] != 0 && masks[i] != fullCoverage)
+        {
+            chars[i] = coverageGlyphTable.glyphs[masks[i]];
+        }
+    }
+}
+
+
+// The grid is split into tiles of tileWidth by tileHeight cells. They are the unit of work of the tiled renderer and
+// the cells covered by one entry of the hierarchical z buffer
+const int tileWidth = 16;
+const int tileHeight = 8;
+const int maxTileCount = ((gridPitch + tileWidth - 1) / tileWidth) * ((maxGridHeight + tileHeight - 1) / tileHeight);
+int tilesX = (screenWidth + tileWidth - 1) / tileWidth;
+int tilesY = (screenHeight + tileHeight - 1) / tileHeight;
+int tileCount = tilesX * tilesY;
+
+
+// Hierarchical z buffer. A coarse level above the zBuffer that keeps the nearest and farthest depth of every tile, so
+// a triangle that is behind everything already drawn in a tile can skip the tile without testing any of its cells
+struct DepthTile
+{
+    double nearest;  // Never less than the greatest (nearest) stored depth in the tile
+    double farthest; // Never more than the smallest (farthest) stored depth in the tile, exact unless dirty is set
+    bool dirty;     // Cells were written since farthest was last worked out, so it may be further away than it needs to be
+};
+DepthTile hiZ[maxTileCount];
+
+
+// The grid cells of a tile as a render target
+template <DepthFormat format>
+RenderTarget gridTileTarget(int tile) {
+    RenderTarget target;
+    target.minX = tile % tilesX * tileWidth;
+    target.minY = tile / tilesX * tileHeight;
+    target.maxX = std::min(target.minX + tileWidth, gridWidth) - 1;
+    target.maxY = std::min(target.minY + tileHeight, gridHeight) - 1;
+    target.chars = &grid[target.minY][target.minX];
+    target.depth = DepthTraits<format>::buffer() + target.minY * gridPitch + target.minX;
+    target.ids = &triangleIds[target.minY][target.minX];
+    target.coverage = &coverageMasks[target.minY][target.minX];
+    target.pitch = gridPitch;
+    return target;
+}
+
+
+template <DepthFormat format>
+void clearDepthTile(DepthTile& depthTile) {
+    depthTile.nearest = DepthTraits<format>::clearValue;
+    depthTile.farthest = DepthTraits<format>::clearValue;
+    depthTile.dirty = false;
+}
+
+
+// Works out the exact nearest and farthest depth of a tile from its cells
+template <DepthFormat format>
+void refreshDepthTile(const RenderTarget& target, DepthTile& depthTile) {
+    typedef typename DepthTraits<format>::Type DepthType;
+    DepthType nearest = *static_cast<const DepthType*>(target.depth), farthest = nearest;
+    for (int y = 0; y <= target.maxY - target.minY; y++) {
+        const DepthType* depth = static_cast<const DepthType*>(target.depth) + y * target.pitch;
+        for (int x = 0; x <= target.maxX - target.minX; x++) {
+            nearest = std::max(nearest, depth[x]);
+            farthest = std::min(farthest, depth[x]);
+        }
+    }
+    depthTile.nearest = nearest;
+    depthTile.farthest = farthest;
+    depthTile.dirty = false;
+}
+
+
+// Draws the part of a triangle inside one tile, unless the tile's depth range shows the triangle is hidden there.
+// The farthest depth is only worked out again when a triangle would otherwise be drawn, which keeps it cheap when
+// many triangles in a row land in front of each other
+template <DepthFormat format, bool visibility>
+void rasterizeEdgeTriangleTile(const EdgeTriangle& tri, const RenderTarget& target, DepthTile& depthTile) {
+    double triangleNearest = DepthTraits<format>::encode(tri.minZ);
+    double triangleFarthest = DepthTraits<format>::encode(tri.maxZ);
+    if (triangleNearest <= depthTile.farthest)
+    {
+        if (!depthTile.dirty)
+        {
+            return; // Every cell in the tile is already nearer than the nearest point of the triangle
+        }
+        refreshDepthTile<format>(target, depthTile);
+        if (triangleNearest <= depthTile.farthest)
+        {
+            return;
+        }
+    }
+
+
+    // When even the farthest point of the triangle is nearer than anything in the tile the depth test always passes
+    bool written = (triangleFarthest > depthTile.nearest) ? rasterizeEdgeTriangle<format, false, visibility>(tri, target) : rasterizeEdgeTriangle<format, true, visibility>(tri, target);
+    if (written)
+    {
+        depthTile.nearest = std::max(depthTile.nearest, triangleNearest);
+        depthTile.dirty = true;
+    }
+}
+
+
+ArenaVector<EdgeTriangle> frameTriangles; // Set up triangles of the current frame, looked up by ID when shading the visibility buffer
+
+
+// Shading pass of the visibility buffer. Every cell of the target a triangle was drawn into gets its character here,
+// with the depth worked out again from the plane of the triangle whose ID is in the cell
+template <DepthFormat format>
+void shadeVisibleCells(const RenderTarget& target) {
+    typedef typename DepthTraits<format>::Type DepthType;
+    for (int y = target.minY; y <= target.maxY; y++) {
+        char* chars = target.chars + (y - target.minY) * target.pitch - target.minX;
+        DepthType* depth = static_cast<DepthType*>(target.depth) + (y - target.minY) * target.pitch - target.minX;
+        const uint32_t* ids = target.ids + (y - target.minY) * target.pitch - target.minX;
+        int x = target.minX;
+
+
+#if GLM_ARCH & (GLM_ARCH_AVX2_BIT | GLM_ARCH_SSE41_BIT)
+        // Gathers the depth and light of every lane from its own triangle, then lights the lanes together
+        for (; x + simdWidth <= target.maxX + 1; x += simdWidth) {
+            int visible[simdWidth];
+            float z[simdWidth], angleIntensity[simdWidth];
+            for (int lane = 0; lane < simdWidth; lane++) {
+                uint32_t id = ids[x + lane];
+                visible[lane] = (id == noTriangle) ? 0 : -1;
+                z[lane] = 1.0f;
+                angleIntensity[lane] = 0.0f;
+                if (id != noTriangle)
+                {
+                    const EdgeTriangle& tri = frameTriangles[id];
+                    z[lane] = tri.z + (x + lane - tri.minX) * tri.stepZX + (y - tri.minY) * tri.stepZY;
+                    angleIntensity[lane] = tri.angleIntensity;
+                }
+            }
+            simdInt mask = simdLoad(visible);
+            if (!simdAny(mask))
+            {
+                continue;
+            }
+
+
+            simdInt glyphs = simdShadeCells(x, y, simdLoad(z), simdLoad(angleIntensity));
+            if constexpr (DepthTraits<format>::packsGlyph)
+            {
+                simdStoreDepth(&depth[x], simdOr(simdLoadDepth(&depth[x]), glyphs), mask);
+            }
+            else
+            {
+                simdStoreChars(&chars[x], glyphs, mask);
+            }
+        }
+#endif
+
+
+        for (; x <= target.maxX; x++) {
+            if (ids[x] == noTriangle)
+            {
+                continue;
+            }
+            const EdgeTriangle& tri = frameTriangles[ids[x]];
+            float z = tri.z + (x - tri.minX) * tri.stepZX + (y - tri.minY) * tri.stepZY;
+            writeCell<format>(depth[x], chars[x], depth[x], shadePixel(x, y, z, tri.angleIntensity)); // The depth is already in place
+        }
+    }
+}
+
+
+template <DepthFormat format, bool visibility>
+void fillTriangleEdge(const ScreenTriangle& triangle) {
+    EdgeTriangle tri;
+    if (!setupEdgeTriangle(triangle, tri))
+    {
+        return;
+    }
+    if (visibility)
+    {
+        tri.id = static_cast<uint32_t>(frameTriangles.size());
+        frameTriangles.push_back(tri);
+    }
+
+
+    // Goes through the triangle tile by tile so the hierarchical z buffer can reject the tiles where it is hidden
+    for (int tileY = tri.coverMinY / tileHeight; tileY <= tri.coverMaxY / tileHeight; tileY++) {
+        for (int tileX = tri.coverMinX / tileWidth; tileX <= tri.coverMaxX / tileWidth; tileX++) {
+            int tile = tileY * tilesX + tileX;
+            RenderTarget target = gridTileTarget<format>(tile);
+            if (coverageSampling)
+            {
+                coverEdgeTriangle(tri, target);
+            }
+            rasterizeEdgeTriangleTile<format, visibility>(tri, target, hiZ[tile]);
+        }
+    }
+}
+
+
+
+
+template <DepthFormat format>
+void drawLine(const ScreenVertex& p1, const ScreenVertex& p2) {
+    int x1 = p1.x >> subPixelBits, y1 = p1.y >> subPixelBits; // Assigns x1 and y1 to p1
+    int x2 = p2.x >> subPixelBits, y2 = p2.y >> subPixelBits; // Assigns x2 and y2 to p2
+    float z1 = p1.z, z2 = p2.z; // Assigns z1 to p1 and z2 to p2
+
+
+    int dx = x2 - x1; // Finds the difference between the first x cooridiante and the second x coordidinate
+    int dy = y2 - y1; // Finds the difference between the first y cooridiante and the second y coordidinate
+   
+    double hypotenuse = sqrt(pow(dx, 2) + pow(dy, 2)); // Finds the hypotenuse of the legs which gives us the distance between them
+
+
+    int steps = static_cast<int>(hypotenuse);
+
+
+    for (int i = 0; i <= steps; i++) {
+        int x = static_cast<int>(x1 + (dx * i) / steps); // Calculates the x cooridiante
+        int y = static_cast<int>(y1 + (dy * i) / steps); // Calculates the y cooridiante
+        float z = z1 + (z2 - z1) * (static_cast<float>(i) / steps) + 1e-6f;
+ // Calculates the z cooridinate
+
+
+        if (x >= 0 && x < gridWidth && y >= 0 && y < gridHeight) // Checks if x and y is on the grid
+        {
+            typename DepthTraits<format>::Type lineDepth = DepthTraits<format>::encode(z);
+            typename DepthTraits<format>::Type& cellDepth = DepthTraits<format>::buffer()[y * gridPitch + x];
+
+
+            // Depth test
+            if (lineDepth > cellDepth)
+            {
+                writeCell<format>(cellDepth, grid[y][x], lineDepth, '*'); // Update the Z-buffer and draw pixel if closer than what's in the Z-buffer
+            }
+            if (lineDepth == cellDepth)
+            {
+                continue;
+            }
+        }
+    }
+}
+
+
+// Copies the characters out of the low bytes of packed depth words into the grid
+void resolvePackedCells(const uint32_t* packed, char* chars, int count) {
+    for (int i = 0; i < count; i++) {
+        chars[i] = static_cast<char>(packed[i] & 0xFF);
+    }
+}
+
+
+// Tiled renderer. Every triangle is set up once and its index is put into the bin of every tile its bounding box
+// touches (sort-middle), then the tiles are handed out to a pool of threads. A thread draws a tile into its own
+// character and depth buffers and copies the finished tile into the grid, and since no two threads ever own the same
+// tile no locks are needed around the grid, the zBuffer or the hierarchical z buffer
+// Indices into frameTriangles of the triangles touching a tile, in submission order. The bins of every tile are
+// slices of one array in the frame arena
+struct TileBin
+{
+    const int* first;
+    const int* last;
+    const int* begin() const { return first; }
+    const int* end() const { return last; }
+};
+TileBin tileBins[maxTileCount];
+
+
+std::vector<std::thread> tileWorkers;
+std::mutex tileMutex;
+std::condition_variable tileWorkReady;     // Wakes the workers when a frame has been binned
+std::condition_variable tileWorkDone;      // Wakes the main thread when the last worker is done with a frame
+int tileFrame = 0;                         // Counts the binned frames so a worker knows when there is new work
+int tileWorkersBusy = 0;                   // Workers still drawing the current frame
+bool tileWorkersStop = false;
+std::atomic<int> nextTile(0);              // Next tile to be drawn, threads take tiles until there are none left
+
+
+// Draws every triangle in one tile's bin and copies the result into the grid
+template <DepthFormat format>
+void rasterizeTile(int tile) {
+    typedef typename DepthTraits<format>::Type DepthType;
+    RenderTarget target = gridTileTarget<format>(tile);
+
+
+    // The tile's own buffers, cleared the same way render() clears the grid
+    char tileChars[tileHeight][tileWidth];
+    DepthType tileDepth[tileHeight][tileWidth];
+    uint32_t tileIds[tileHeight][tileWidth];
+    uint8_t tileCoverage[tileHeight][tileWidth];
+    for (int y = 0; y < tileHeight; y++) {
+        for (int x = 0; x < tileWidth; x++) {
+            tileChars[y][x] = ' ';
+            tileDepth[y][x] = DepthTraits<format>::clearValue;
+            tileIds[y][x] = noTriangle;
+            tileCoverage[y][x] = 0;
+        }
+    }
+    target.chars = &tileChars[0][0];
+    target.depth = &tileDepth[0][0];
+    target.ids = &tileIds[0][0];
+    target.coverage = &tileCoverage[0][0];
+    target.pitch = tileWidth;
+
+
+    if (coverageSampling)
+    {
+        for (int i : tileBins[tile]) {
+            coverEdgeTriangle(frameTriangles[i], target);
+        }
+    }
+
+
+    DepthTile depthTile;
+    clearDepthTile<format>(depthTile);
+    if (visibilityBuffer)
+    {
+        for (int i : tileBins[tile]) {
+            rasterizeEdgeTriangleTile<format, true>(frameTriangles[i], target, depthTile);
+        }
+        shadeVisibleCells<format>(target);
+    }
+    else
+    {
+        for (int i : tileBins[tile]) {
+            rasterizeEdgeTriangleTile<format, false>(frameTriangles[i], target, depthTile);
+        }
+    }
+    if (depthTile.dirty)
+    {
+        refreshDepthTile<format>(target, depthTile);
+    }
+    hiZ[tile] = depthTile;
+
+
+    // Copy the finished tile into the grid
+    int width = target.maxX - target.minX + 1;
+    for (int y = target.minY; y <= target.maxY; y++) {
+        std::memcpy(DepthTraits<format>::buffer() + y * gridPitch + target.minX, tileDepth[y - target.minY], width * sizeof(DepthType));
+        if constexpr (DepthTraits<format>::packsGlyph)
+        {
+            resolvePackedCells(tileDepth[y - target.minY], &grid[y][target.minX], width);
+        }
+        else
+        {
+            std::memcpy(&grid[y][target.minX], tileChars[y - target.minY], width * sizeof(char));
+        }
+        if (coverageSampling)
+        {
+            resolveCoverage(tileCoverage[y - target.minY], &grid[y][target.minX], width);
+        }
+    }
+}
+
+
+// Takes tiles off the shared counter until all of them have been drawn
+void rasterizeTiles() {
+    for (int tile = nextTile++; tile < tileCount; tile = nextTile++) {
+        switch (depthFormat)
+        {
+        case DepthFormat::Float32: rasterizeTile<DepthFormat::Float32>(tile); break;
+        case DepthFormat::Unorm24: rasterizeTile<DepthFormat::Unorm24>(tile); break;
+        case DepthFormat::Unorm16: rasterizeTile<DepthFormat::Unorm16>(tile); break;
+        case DepthFormat::Packed24: rasterizeTile<DepthFormat::Packed24>(tile); break;
+        }
+    }
+}
+
+
+void tileWorker() {
+    int frame = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(tileMutex);
+            tileWorkReady.wait(lock, [&] { return tileWorkersStop || tileFrame != frame; });
+            if (tileWorkersStop)
+            {
+                return;
+            }
+            frame = tileFrame;
+        }
+
+
+        rasterizeTiles();
+
+
+        std::lock_guard<std::mutex> lock(tileMutex);
+        if (--tileWorkersBusy == 0)
+        {
+            tileWorkDone.notify_one();
+        }
+    }
+}
+
+
+// Starts one worker for every core except the one the main thread is running on, which helps out with the tiles itself
+void startTileWorkers() {
+    unsigned int cores = std::thread::hardware_concurrency();
+    for (unsigned int i = 1; i < cores; i++) {
+        tileWorkers.emplace_back(tileWorker);
+    }
+}
+
+
+void stopTileWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(tileMutex);
+        tileWorkersStop = true;
+    }
+    tileWorkReady.notify_all();
+    for (std::thread& worker : tileWorkers) {
+        worker.join();
+    }
+    tileWorkers.clear();
+}
+
+
+void renderTiled(const ArenaVector<ScreenTriangle>& triangles) {
+    // Set up every triangle and count how many go into the bin of each tile its bounding box touches
+    int binSize[maxTileCount] = {};
+    frameTriangles.clear();
+    frameTriangles.reserve(triangles.size());
+    for (const ScreenTriangle& triangle : triangles) {
+        EdgeTriangle tri;
+        if (!setupEdgeTriangle(triangle, tri))
+        {
+            continue;
+        }
+
+
+        tri.id = static_cast<uint32_t>(frameTriangles.size());
+        frameTriangles.push_back(tri);
+        for (int tileY = tri.coverMinY / tileHeight; tileY <= tri.coverMaxY / tileHeight; tileY++) {
+            for (int tileX = tri.coverMinX / tileWidth; tileX <= tri.coverMaxX / tileWidth; tileX++) {
+                binSize[tileY * tilesX + tileX]++;
+            }
+        }
+    }
+
+
+    // Lay the bins out back to back and fill them in a second pass, which keeps every bin in submission order
+    int binnedCount = 0;
+    for (int tile = 0; tile < tileCount; tile++) {
+        binnedCount += binSize[tile];
+    }
+    int* binned = static_cast<int*>(frameArena.allocate(std::max(binnedCount, 1) * sizeof(int), alignof(int)));
+    int* binEnd[maxTileCount];
+    for (int tile = 0, offset = 0; tile < tileCount; tile++) {
+        binEnd[tile] = binned + offset;
+        offset += binSize[tile];
+    }
+    for (const EdgeTriangle& tri : frameTriangles) {
+        for (int tileY = tri.coverMinY / tileHeight; tileY <= tri.coverMaxY / tileHeight; tileY++) {
+            for (int tileX = tri.coverMinX / tileWidth; tileX <= tri.coverMaxX / tileWidth; tileX++) {
+                *binEnd[tileY * tilesX + tileX]++ = static_cast<int>(tri.id);
+            }
+        }
+    }
+    for (int tile = 0; tile < tileCount; tile++) {
+        tileBins[tile] = { binEnd[tile] - binSize[tile], binEnd[tile] };
+    }
+
+
+    if (tileWorkers.empty())
+    {
+        startTileWorkers();
+    }
+
+
+    // Wake the workers and draw tiles on this thread as well until every tile is done
+    nextTile = 0;
+    {
+        std::lock_guard<std::mutex> lock(tileMutex);
+        tileWorkersBusy = static_cast<int>(tileWorkers.size());
+        tileFrame++;
+    }
+    tileWorkReady.notify_all();
+    rasterizeTiles();
+
+
+    std::unique_lock<std::mutex> lock(tileMutex);
+    tileWorkDone.wait(lock, [] { return tileWorkersBusy == 0; });
+}
+
+
+// Clears the grid and draws the triangles one after the other with the scanline or the edge function rasterizer
+template <DepthFormat format>
+void rasterizeTriangles(const ArenaVector<ScreenTriangle>& triangles) {
+    // Iterates over every position in the grid and assigns default values
+    for (int y = 0; y < gridHeight; y++) {
+        for (int x = 0; x < gridWidth; x++) {
+            grid[y][x] = ' ';
+        }
+    }
+    std::fill(DepthTraits<format>::buffer(), DepthTraits<format>::buffer() + gridPitch * gridHeight, DepthTraits<format>::clearValue); // Reversed depth, 0 is the far plane
+    for (DepthTile& depthTile : hiZ) {
+        clearDepthTile<format>(depthTile);
+    }
+    bool visibility = visibilityBuffer && rasterizer == Rasterizer::EdgeFunction; // The scanline rasterizer always shades as it goes
+    if (visibility)
+    {
+        std::fill(&triangleIds[0][0], &triangleIds[0][0] + gridPitch * gridHeight, noTriangle);
+        frameTriangles.clear();
+        frameTriangles.reserve(triangles.size());
+    }
+    bool coverage = coverageSampling && rasterizer == Rasterizer::EdgeFunction;
+    if (coverage)
+    {
+        std::fill(&coverageMasks[0][0], &coverageMasks[0][0] + gridPitch * gridHeight, 0);
+    }
+
+
+    for (const ScreenTriangle& triangle : triangles) {
+        if (visibility)
+        {
+            fillTriangleEdge<format, true>(triangle);
+        }
+        else if (rasterizer == Rasterizer::EdgeFunction)
+        {
+            fillTriangleEdge<format, false>(triangle);
+        }
+        else
+        {
+            fillTriangle<format>(triangle);
+        }
+
+    }
+
+
+    // Shades every visible cell of the grid once all the triangles are in
+    if (visibility)
+    {
+        RenderTarget target;
+        target.chars = &grid[0][0];
+        target.depth = DepthTraits<format>::buffer();
+        target.ids = &triangleIds[0][0];
+        target.pitch = gridPitch;
+        target.minX = 0; target.minY = 0;
+        target.maxX = gridWidth - 1; target.maxY = gridHeight - 1;
+        shadeVisibleCells<format>(target);
+    }
+
+
+    if constexpr (DepthTraits<format>::packsGlyph)
+    {
+        resolvePackedCells(DepthTraits<format>::buffer(), &grid[0][0], gridPitch * gridHeight);
+    }
+    if (coverage)
+    {
+        resolveCoverage(&coverageMasks[0][0], &grid[0][0], gridPitch * gridHeight);
+    }
+}
+
+
+// Switches the output mode and resizes the grid and the tiles to match, only called between frames
+void setOutputMode(OutputMode mode) {
+    outputMode = mode;
+    gridWidth = (mode == OutputMode::Braille) ? screenWidth * 2 : screenWidth;
+    gridHeight = (mode == OutputMode::Braille) ? screenHeight * 4 : (mode == OutputMode::HalfBlock) ? screenHeight * 2 : screenHeight;
+    tilesX = (gridWidth + tileWidth - 1) / tileWidth;
+    tilesY = (gridHeight + tileHeight - 1) / tileHeight;
+    tileCount = tilesX * tilesY;
+    cellWidth = static_cast<float>(screenWidth) / gridWidth;
+    cellHeight = static_cast<float>(screenHeight) / gridHeight;
+}
+
+
+// Lookup tables of the half block and braille output modes, built when the program starts
+struct OutputTables
+{
+    int gray[256];                   // Gray level from 0 to 23 a grid character is drawn with, or -1 for an empty cell
+    char braille[256][3];            // UTF-8 of the braille pattern with the dots in each mask raised, U+2800 to U+28FF
+    std::string foreground[24];      // Escape sequences selecting each of the 24 grays of the 256 colour palette
+    std::string background[24];
+};
+
+
+OutputTables buildOutputTables() {
+    OutputTables tables;
+
+
+    // The ramp characters get evenly spaced grays, anything else (the coverage shapes) is drawn half bright
+    int rampLength = static_cast<int>(std::strlen(glyphRamp));
+    for (int c = 0; c < 256; c++) {
+        tables.gray[c] = (c == ' ') ? -1 : 12;
+    }
+    for (int i = 0; i < rampLength; i++) {
+        tables.gray[static_cast<unsigned char>(glyphRamp[i])] = (i + 1) * 23 / rampLength;
+    }
+
+
+    for (int mask = 0; mask < 256; mask++) {
+        int codePoint = 0x2800 + mask;
+        tables.braille[mask][0] = static_cast<char>(0xE0 | (codePoint >> 12));
+        tables.braille[mask][1] = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        tables.braille[mask][2] = static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+
+
+    for (int level = 0; level < 24; level++) {
+        tables.foreground[level] = "\033[38;5;" + std::to_string(232 + level) + "m";
+        tables.background[level] = "\033[48;5;" + std::to_string(232 + level) + "m";
+    }
+    return tables;
+}
+const OutputTables outputTables = buildOutputTables();
+
+
+// Bytes of the text the frame time is written with, on the line below the screen
+const size_t frameTimeSize = 48;
+
+
+// Most bytes one row of the screen can be encoded in. A half block character can need both colours changed, two escape
+// sequences of at most 11 bytes, before its 3 bytes, and a patched row can start a run at any character, with a cursor
+// move of at most 10 bytes. The row may also erase the line first
+const size_t maxEncodedRowSize = screenWidth * (25 + 10) + 16;
+
+
+// A frame is sent as a synchronized update (DEC private mode 2026), the terminal holds off drawing from the first
+// sequence to the second so it never shows half a frame. Terminals without the mode ignore them
+const char beginSynchronizedUpdate[] = "\033[?2026h";
+const char endSynchronizedUpdate[] = "\033[?2026l";
+
+
+// Room for the encoded frame. There is one row to spare because a patched row is compared against its rewrite, which
+// is encoded after it before the longer of the two is dropped
+size_t maxEncodedFrameSize() {
+    return (screenHeight + 1) * maxEncodedRowSize + frameTimeSize + sizeof(beginSynchronizedUpdate) + sizeof(endSynchronizedUpdate);
+}
+
+
+void setCell(TerminalCell& cell, const char* glyph, int length, int foreground = -1, int background = -1) {
+    cell.glyph[0] = glyph[0];
+    cell.glyph[1] = (length > 1) ? glyph[1] : 0;
+    cell.glyph[2] = (length > 2) ? glyph[2] : 0;
+    cell.length = static_cast<uint8_t>(length);
+    cell.foreground = static_cast<int8_t>(foreground);
+    cell.background = static_cast<int8_t>(background);
+}
+
+
+// Writes the grid one character per cell
+void outputAscii(TerminalFrame& frame) {
+    for (int y = 0; y < gridHeight; y++) {
+        for (int x = 0; x < gridWidth; x++) {
+            setCell(frame.cells[y][x], &grid[y][x], 1);
+        }
+    }
+}
+
+
+// Writes two rows of the grid per line of characters. The upper half block is drawn with the top cell's gray as the
+// foreground and the bottom cell's as the background
+void outputHalfBlock(TerminalFrame& frame) {
+    const char upperHalf[] = "\xE2\x96\x80"; // U+2580
+    const char lowerHalf[] = "\xE2\x96\x84"; // U+2584
+    for (int y = 0; y < gridHeight; y += 2) {
+        for (int x = 0; x < gridWidth; x++) {
+            int top = outputTables.gray[static_cast<unsigned char>(grid[y][x])];
+            int bottom = outputTables.gray[static_cast<unsigned char>(grid[y + 1][x])];
+            TerminalCell& cell = frame.cells[y / 2][x];
+
+
+            // With only one half drawn the other keeps the terminal's background, so the drawn half goes in the foreground
+            if (top < 0 && bottom < 0)
+            {
+                setCell(cell, " ", 1);
+            }
+            else if (top < 0)
+            {
+                setCell(cell, lowerHalf, 3, bottom);
+            }
+            else
+            {
+                setCell(cell, upperHalf, 3, top, bottom);
+            }
+        }
+    }
+}
+
+
+// Writes two by four cells of the grid per character as a braille pattern. Each dot has its own brightness threshold
+// (an ordered dither), so brighter cells raise more of the dots and the shading still shows
+void outputBraille(TerminalFrame& frame) {
+    const int dotBit[4][2] = { { 0x01, 0x08 }, { 0x02, 0x10 }, { 0x04, 0x20 }, { 0x40, 0x80 } }; // Unicode dot numbering
+    const int dotThreshold[4][2] = { { 0, 12 }, { 18, 6 }, { 3, 15 }, { 21, 9 } };
+    for (int y = 0; y < gridHeight; y += 4) {
+        for (int x = 0; x < gridWidth; x += 2) {
+            int mask = 0;
+            for (int row = 0; row < 4; row++) {
+                for (int column = 0; column < 2; column++) {
+                    if (outputTables.gray[static_cast<unsigned char>(grid[y + row][x + column])] >= dotThreshold[row][column])
+                    {
+                        mask |= dotBit[row][column];
+                    }
+                }
+            }
+            if (mask == 0)
+            {
+                setCell(frame.cells[y / 4][x / 2], " ", 1); // Same width as the blank pattern and a third of the bytes
+                continue;
+            }
+            setCell(frame.cells[y / 4][x / 2], outputTables.braille[mask], 3);
+        }
+    }
+}
+
+
+// Where the terminal's cursor is and the colours it writes with. Everything starts out unknown, so the colours and the
+// position are sent before they are relied on
+struct TerminalCursor
+{
+    int row = -1;                  // -1 when the position is not known, like after writing into the last column
+    int column = -1;
+    int foreground = -2;           // -2 when the colour is not known
+    int background = -2;
+};
+
+
+// What the terminal is showing, which the next frame is encoded against. No cell matches a zeroed one, so the first
+// frame writes every row
+struct TerminalState
+{
+    TerminalCell cells[screenHeight][screenWidth];
+    TerminalCursor cursor;
+};
+TerminalState terminal; // Only used by the output thread
+FrameText terminalText; // Encoded frame the output thread writes
+
+
+bool isBlank(const TerminalCell& cell) {
+    return cell.length == 1 && cell.glyph[0] == ' ' && cell.background < 0;
+}
+
+
+void encodeMove(int row, int column, TerminalCursor& cursor, FrameText& text) {
+    if (cursor.row == row && cursor.column == column)
+    {
+        return;
+    }
+    char move[16];
+    int length = std::snprintf(move, sizeof(move), "\033[%d;%dH", row + 1, column + 1);
+    text.append(move, static_cast<size_t>(length));
+    cursor.row = row;
+    cursor.column = column;
+}
+
+
+// Bytes of a cursor move, what it costs to skip over cells instead of writing them again. The shortest, "\033[1;1H",
+// is 6 bytes, and every digit the row or the column takes past the first adds one
+int cursorMoveSize(int row, int column) {
+    return 6 + (row + 1 >= 10) + (row + 1 >= 100) + (column + 1 >= 10) + (column + 1 >= 100);
+}
+
+
+const char defaultForeground[] = "\033[39m";
+const char defaultBackground[] = "\033[49m";
+const int maxColourSize = 11; // "\033[48;5;255m"
+
+
+void encodeForeground(int foreground, TerminalCursor& cursor, FrameText& text) {
+    if (foreground != cursor.foreground)
+    {
+        text.append((foreground >= 0) ? outputTables.foreground[foreground].c_str() : defaultForeground);
+        cursor.foreground = foreground;
+    }
+}
+
+
+void encodeBackground(int background, TerminalCursor& cursor, FrameText& text) {
+    if (background != cursor.background)
+    {
+        text.append((background >= 0) ? outputTables.background[background].c_str() : defaultBackground);
+        cursor.background = background;
+    }
+}
+
+
+// Bytes encodeCells writes for a cell, the colours it changes included. The colours are followed along in the cursor
+int encodedCellSize(const TerminalCell& cell, TerminalCursor& cursor) {
+    int size = cell.length;
+    if (cell.background != cursor.background)
+    {
+        size += (cell.background >= 0) ? static_cast<int>(outputTables.background[cell.background].size()) : static_cast<int>(sizeof(defaultBackground) - 1);
+        cursor.background = cell.background;
+    }
+    if (!(cell.length == 1 && cell.glyph[0] == ' ') && cell.foreground != cursor.foreground)
+    {
+        size += (cell.foreground >= 0) ? static_cast<int>(outputTables.foreground[cell.foreground].size()) : static_cast<int>(sizeof(defaultForeground) - 1);
+        cursor.foreground = cell.foreground;
+    }
+    return size;
+}
+
+
+// Writes cells from the cursor on, sending the colours only when they change. A blank doesn't show its foreground, so
+// it leaves the foreground alone
+void encodeCells(const TerminalCell* cells, int row, int begin, int end, TerminalCursor& cursor, FrameText& text) {
+    encodeMove(row, begin, cursor, text);
+    for (int x = begin; x < end; x++) {
+        const TerminalCell& cell = cells[x];
+        encodeBackground(cell.background, cursor, text);
+        if (!(cell.length == 1 && cell.glyph[0] == ' '))
+        {
+            encodeForeground(cell.foreground, cursor, text);
+        }
+        text.append(cell.glyph, cell.length);
+    }
+    cursor.column = (end < screenWidth) ? end : -1; // Past the last column the terminal waits to wrap
+}
+
+
+// Writes only the runs of changed cells. The unchanged cells between two runs are written again when they and the next
+// changed cell take fewer bytes than a cursor move and that cell, counting the colour changes either way needs
+void patchRow(const TerminalCell* cells, const TerminalCell* shown, int row, TerminalCursor& cursor, FrameText& text) {
+    int x = 0;
+    while (x < screenWidth) {
+        if (std::memcmp(&cells[x], &shown[x], sizeof(TerminalCell)) == 0)
+        {
+            x++;
+            continue;
+        }
+
+
+        // The colours after the run so far, and after the run and the unchanged cells behind it
+        TerminalCursor run = cursor;
+        encodedCellSize(cells[x], run);
+        TerminalCursor bridged = run;
+        int runEnd = x + 1;
+        int gapBytes = 0;
+        for (int next = runEnd; next < screenWidth; next++) {
+            if (std::memcmp(&cells[next], &shown[next], sizeof(TerminalCell)) == 0)
+            {
+                // Past a move and both colour changes no cell after the gap can make writing it pay off
+                gapBytes += encodedCellSize(cells[next], bridged);
+                if (gapBytes > cursorMoveSize(row, next) + 2 * maxColourSize)
+                {
+                    break;
+                }
+                continue;
+            }
+
+
+            TerminalCursor moved = run;
+            int bridgeBytes = gapBytes + encodedCellSize(cells[next], bridged);
+            int moveBytes = ((gapBytes > 0) ? cursorMoveSize(row, next) : 0) + encodedCellSize(cells[next], moved);
+            if (bridgeBytes > moveBytes)
+            {
+                break;
+            }
+            run = bridged;
+            runEnd = next + 1;
+            gapBytes = 0;
+        }
+        encodeCells(cells, row, x, runEnd, cursor, text);
+        x = runEnd;
+    }
+}
+
+
+// Erases the line and writes it again from its first to its last character, skipping the blanks around them
+void rewriteRow(const TerminalCell* cells, int row, TerminalCursor& cursor, FrameText& text) {
+    int last = screenWidth;
+    while (last > 0 && isBlank(cells[last - 1])) {
+        last--;
+    }
+    int first = 0;
+    while (first < last && isBlank(cells[first])) {
+        first++;
+    }
+    encodeBackground(-1, cursor, text); // The erased line takes the current background colour
+    encodeMove(row, first, cursor, text);
+    text.append("\033[2K");
+    encodeCells(cells, row, first, last, cursor, text);
+}
+
+
+// Encodes the escape sequences and text that turn what the terminal shows into the frame. Each row is skipped when it
+// hasn't changed, and otherwise both patched and rewritten, keeping whichever took fewer bytes
+void encodeFrame(const TerminalFrame& frame, TerminalState& state, FrameText& text) {
+    text.clear();
+    text.append(beginSynchronizedUpdate);
+    for (int y = 0; y < screenHeight; y++) {
+        const TerminalCell* cells = frame.cells[y];
+        if (std::memcmp(cells, state.cells[y], sizeof(state.cells[y])) == 0)
+        {
+            continue;
+        }
+
+
+        size_t patchStart = text.size();
+        TerminalCursor before = state.cursor;
+        patchRow(cells, state.cells[y], y, state.cursor, text);
+        TerminalCursor patched = state.cursor;
+        size_t rewriteStart = text.size();
+        state.cursor = before;
+        rewriteRow(cells, y, state.cursor, text);
+        if (text.size() - rewriteStart < rewriteStart - patchStart)
+        {
+            text.erase(patchStart, rewriteStart);
+        }
+        else
+        {
+            text.resize(rewriteStart);
+            state.cursor = patched;
+        }
+        std::memcpy(state.cells[y], cells, sizeof(state.cells[y]));
+    }
+
+
+    // The frame time goes on the line below the screen, clearing what is left of the last one
+    char frameTime[frameTimeSize / 2];
+    int length = std::snprintf(frameTime, sizeof(frameTime), "%g", frame.frameTime);
+    encodeForeground(-1, state.cursor, text);
+    encodeBackground(-1, state.cursor, text);
+    encodeMove(screenHeight, 0, state.cursor, text);
+    text.append(frameTime, static_cast<size_t>(length));
+    text.append("\033[K");
+    state.cursor.column = length;
+    text.append(endSynchronizedUpdate);
+}
+
+
+// Rasterizes the triangles and writes the characters of the screen into the frame. The output stage works out what
+// has to be sent to the terminal
+void render(const ArenaVector<ScreenTriangle>& triangles, TerminalFrame& frame) {
+
+
+    if (rasterizer == Rasterizer::Tiled)
+    {
+        renderTiled(triangles); // Every tile clears its own part of the grid
+    }
+    else
+    {
+        switch (depthFormat)
+        {
+        case DepthFormat::Float32: rasterizeTriangles<DepthFormat::Float32>(triangles); break;
+        case DepthFormat::Unorm24: rasterizeTriangles<DepthFormat::Unorm24>(triangles); break;
+        case DepthFormat::Unorm16: rasterizeTriangles<DepthFormat::Unorm16>(triangles); break;
+        case DepthFormat::Packed24: rasterizeTriangles<DepthFormat::Packed24>(triangles); break;
+        }
+    }
+
+
+
+    // Build the characters of the screen from the grid
+    switch (outputMode)
+    {
+    case OutputMode::Ascii: outputAscii(frame); break;
+    case OutputMode::HalfBlock: outputHalfBlock(frame); break;
+    case OutputMode::Braille: outputBraille(frame); break;
+    }
+}
+
+
+// How far past the edges of the screen, in multiples of the half screen, a vertex may lie before its triangle is clipped
+// in x and y. Triangles inside the guard band go to the rasterizers whole and get cut down to the grid by their bounding
+// boxes, which is cheaper and more exact than clipping. The band is bounded by the fixed point edge functions, which
+// have to fit in an int for the largest grid
+const float guardBand = 4.0f;
+const int clipPlaneCount = 6;
+const int maxClipVertices = 3 + clipPlaneCount; // Every plane can add at most one vertex to a convex polygon
+
+
+// Signed distance of a clip space vertex to a clipping plane, positive on the side that is kept. The near and far planes
+// are the real frustum planes (-w <= z <= w), the four side planes are the guard band instead of the screen edges
+float clipDistance(const glm::vec4& v, int plane) {
+    switch (plane) {
+    case 0: return v.w + v.z;             // Near
+    case 1: return v.w - v.z;             // Far
+    case 2: return guardBand * v.w + v.x; // Left
+    case 3: return guardBand * v.w - v.x; // Right
+    case 4: return guardBand * v.w + v.y; // Bottom
+    default: return guardBand * v.w - v.y; // Top
+    }
+}
+
+
+// Bit per frustum plane the vertex is outside of. A triangle whose vertices are all outside the same plane can't be
+// seen and is dropped before any clipping
+int frustumOutcode(const glm::vec4& v) {
+    return (v.z < -v.w ? 1 : 0) | (v.z > v.w ? 2 : 0) | (v.x < -v.w ? 4 : 0) | (v.x > v.w ? 8 : 0) | (v.y < -v.w ? 16 : 0) | (v.y > v.w ? 32 : 0);
+}
+
+
+// Bit per clipping plane the vertex is outside of
+int clipOutcode(const glm::vec4& v) {
+    int code = 0;
+    for (int plane = 0; plane < clipPlaneCount; plane++) {
+        code |= clipDistance(v, plane) < 0.0f ? 1 << plane : 0;
+    }
+    return code;
+}
+
+
+// Sutherland-Hodgman clipping of a convex polygon against the planes in planeMask, in clip space so the intersections
+// are found before the perspective divide and stay correct for vertices behind the camera. Returns the new vertex count
+int clipPolygon(glm::vec4* polygon, int count, int planeMask) {
+    glm::vec4 clipped[maxClipVertices];
+    for (int plane = 0; plane < clipPlaneCount && count > 0; plane++) {
+        if ((planeMask & (1 << plane)) == 0)
+        {
+            continue; // No vertex is outside this plane
+        }
+
+
+        int clippedCount = 0;
+        for (int i = 0; i < count; i++) {
+            const glm::vec4& current = polygon[i];
+            const glm::vec4& next = polygon[(i + 1) % count];
+            float currentDistance = clipDistance(current, plane), nextDistance = clipDistance(next, plane);
+            if (currentDistance >= 0.0f)
+            {
+                clipped[clippedCount++] = current;
+            }
+
+
+            // The edge crosses the plane, so the point where it does becomes a vertex of the clipped polygon
+            if ((currentDistance >= 0.0f) != (nextDistance >= 0.0f))
+            {
+                float t = currentDistance / (currentDistance - nextDistance);
+                clipped[clippedCount++] = current + (next - current) * t;
+            }
+        }
+        std::copy(clipped, clipped + clippedCount, polygon);
+        count = clippedCount;
+    }
+    return count;
+}
+
+
+// Fixed point grid position and depth of a clip space position in front of the near plane
+ScreenVertex clipToScreen(const glm::vec4& v) {
+    float invW = 1.0f / v.w;
+    return { mapToGrid(v.x * invW, gridWidth), mapToGrid(v.y * invW, gridHeight), v.z * invW, 0 };
+}
+
+
+// Vertex stage. Transforms every vertex to clip space, works out which planes it is outside of and, for the vertices
+// that need no clipping, does the perspective divide and the mapping to the grid in the same pass. The SIMD loop does
+// simdWidth vertices at a time with the matrix columns broadcast once. The scalar loop does the same operations in the
+// same order, so both give the same bits and only has to pick up where the SIMD loop stopped. The streams of out have
+// to be reserved for in by reserveTransformedVertices and set up by prepareTransformedVertices first
+void transformVertices(const glm::mat4& transform, const VertexStreams& in, TransformedVertices& out) {
+    int padded = (in.count + simdWidth - 1) / simdWidth * simdWidth;
+    int i = 0;
+#if GLM_ARCH & (GLM_ARCH_AVX2_BIT | GLM_ARCH_SSE41_BIT)
+    simdFloat m[4][4];
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 4; row++) {
+            m[column][row] = simdSet(transform[column][row]);
+        }
+    }
+    const simdFloat zero = simdSet(0.0f), one = simdSet(1.0f), half = simdSet(0.5f), band = simdSet(guardBand);
+    const simdFloat viewportX = simdSet(static_cast<float>(gridWidth * subPixelHalf)), viewportY = simdSet(static_cast<float>(gridHeight * subPixelHalf));
+    for (; i + simdWidth <= padded; i += simdWidth) {
+        simdFloat x = simdLoad(&in.x[i]), y = simdLoad(&in.y[i]), z = simdLoad(&in.z[i]);
+        simdFloat clip[4];
+        for (int row = 0; row < 4; row++) {
+            clip[row] = simdAdd(simdAdd(simdAdd(simdMul(x, m[0][row]), simdMul(y, m[1][row])), simdMul(z, m[2][row])), m[3][row]);
+        }
+        simdStore(&out.clipX[i], clip[0]); simdStore(&out.clipY[i], clip[1]);
+        simdStore(&out.clipZ[i], clip[2]); simdStore(&out.clipW[i], clip[3]);
+
+
+        // Outcodes, the same comparisons as frustumOutcode and clipOutcode with each true lane masked down to its bit
+        simdFloat negW = simdSub(zero, clip[3]), bandW = simdMul(band, clip[3]);
+        simdInt codes = simdAnd(simdLess(clip[2], negW), simdSet(1));
+        codes = simdOr(codes, simdAnd(simdGreater(clip[2], clip[3]), simdSet(2)));
+        codes = simdOr(codes, simdAnd(simdLess(clip[0], negW), simdSet(4)));
+        codes = simdOr(codes, simdAnd(simdGreater(clip[0], clip[3]), simdSet(8)));
+        codes = simdOr(codes, simdAnd(simdLess(clip[1], negW), simdSet(16)));
+        codes = simdOr(codes, simdAnd(simdGreater(clip[1], clip[3]), simdSet(32)));
+        codes = simdOr(codes, simdAnd(simdLess(simdAdd(clip[3], clip[2]), zero), simdSet(1 << 8)));
+        codes = simdOr(codes, simdAnd(simdLess(simdSub(clip[3], clip[2]), zero), simdSet(2 << 8)));
+        codes = simdOr(codes, simdAnd(simdLess(simdAdd(bandW, clip[0]), zero), simdSet(4 << 8)));
+        codes = simdOr(codes, simdAnd(simdLess(simdSub(bandW, clip[0]), zero), simdSet(8 << 8)));
+        codes = simdOr(codes, simdAnd(simdLess(simdAdd(bandW, clip[1]), zero), simdSet(16 << 8)));
+        codes = simdOr(codes, simdAnd(simdLess(simdSub(bandW, clip[1]), zero), simdSet(32 << 8)));
+
+
+        // Perspective divide and viewport mapping, computed for every lane. The lanes that need clipping get garbage
+        // that triangulateWithIndices never reads
+        simdFloat invW = simdDiv(one, clip[3]);
+        simdFloat screenX = simdFloor(simdAdd(simdMul(simdAdd(simdMul(clip[0], invW), one), viewportX), half));
+        simdFloat screenY = simdFloor(simdAdd(simdMul(simdAdd(simdMul(clip[1], invW), one), viewportY), half));
+        simdStoreScreenVertices(&out.screen[i], simdTruncate(screenX), simdTruncate(screenY), simdMul(clip[2], invW), codes);
+    }
+#endif
+    for (; i < padded; i++) {
+        glm::vec4 clip;
+        for (int row = 0; row < 4; row++) {
+            clip[row] = in.x[i] * transform[0][row] + in.y[i] * transform[1][row] + in.z[i] * transform[2][row] + transform[3][row];
+        }
+        out.clipX[i] = clip.x; out.clipY[i] = clip.y; out.clipZ[i] = clip.z; out.clipW[i] = clip.w;
+        int clipCodes = frustumOutcode(clip) | clipOutcode(clip) << 8;
+        if (clipCodes >> 8 == 0)
+        {
+            out.screen[i] = clipToScreen(clip);
+        }
+        out.screen[i].clipCodes = clipCodes;
+    }
+}
+
+
+// Sizes the streams for count vertices. This allocates, so it is done when the meshes are known, before any frame
+void reserveTransformedVertices(int count, TransformedVertices& out) {
+    size_t padded = static_cast<size_t>((count + simdWidth - 1) / simdWidth * simdWidth);
+    if (out.screen.size() < padded)
+    {
+        out.clipX.resize(padded); out.clipY.resize(padded); out.clipZ.resize(padded); out.clipW.resize(padded);
+        out.screen.resize(padded);
+    }
+}
+
+
+// Sets the streams up for a draw of count vertices. They are never grown here, that would allocate in the middle of
+// a frame, so they have to have been reserved for count already
+void prepareTransformedVertices(int count, TransformedVertices& out) {
+    assert(out.screen.size() >= static_cast<size_t>((count + simdWidth - 1) / simdWidth * simdWidth) && "the vertex stage wasn't reserved for this draw");
+    out.count = count;
+}
+
+
+// Adds the screen vertices of each triangle to triangles, so the triangles of several meshes end up in one array
+void triangulateWithIndices(const TransformedVertices& vertices, const unsigned int* indices, int numIndices, ArenaVector<ScreenTriangle>& triangles) {
+    triangles.reserve(triangles.size() + numIndices / 3); // Enough unless clipping splits triangles, and growing extends it in place
+
+
+    // Iterates over every 3 indices
+    for (int i = 0; i < numIndices; i += 3) {
+        unsigned int index1 = indices[i], index2 = indices[i + 1], index3 = indices[i + 2];
+        if (index1 >= static_cast<unsigned int>(vertices.count) || index2 >= static_cast<unsigned int>(vertices.count) || index3 >= static_cast<unsigned int>(vertices.count))
+        {
+            continue; // Skip invalid indices.
+        }
+
+
+        // Skip triangles that are entirely outside one side of the view
+        const ScreenVertex& vertex1 = vertices.screen[index1], & vertex2 = vertices.screen[index2], & vertex3 = vertices.screen[index3];
+        int code1 = vertex1.clipCodes, code2 = vertex2.clipCodes, code3 = vertex3.clipCodes;
+        if ((code1 & code2 & code3 & 0xFF) != 0)
+        {
+            continue;
+        }
+
+
+        // Triangles with every vertex inside the near and far planes and the guard band use the positions the vertex
+        // stage already mapped to the grid
+        int planeMask = (code1 | code2 | code3) >> 8;
+        if (planeMask == 0)
+        {
+            triangles.push_back({ { vertex1, vertex2, vertex3 } });
+            continue;
+        }
+
+
+        // Clip space corners of the triangle, the array has room for the vertices clipping adds
+        glm::vec4 polygon[maxClipVertices];
+        const unsigned int corners[3] = { index1, index2, index3 };
+        for (int corner = 0; corner < 3; corner++) {
+            unsigned int index = corners[corner];
+            polygon[corner] = glm::vec4(vertices.clipX[index], vertices.clipY[index], vertices.clipZ[index], vertices.clipW[index]);
+        }
+        int count = clipPolygon(polygon, 3, planeMask);
+
+
+        // Perspective divide and mapping of the clipped polygon to the grid. Every w is positive after near clipping
+        ScreenVertex screen[maxClipVertices];
+        for (int corner = 0; corner < count; corner++) {
+            screen[corner] = clipToScreen(polygon[corner]);
+        }
+
+
+        // The clipped polygon is convex, so a fan from its first vertex splits it into triangles with the original winding
+        for (int corner = 2; corner < count; corner++) {
+            triangles.push_back({ { screen[0], screen[corner - 1], screen[corner] } });
+        }
+    }
+}
+
+
+// Read only view of a whole file. The parser reads the mapped pages straight from the file cache instead of copying the
+// file into a buffer first, and the threads parsing it share the one mapping
+class MappedFile
+{
+public:
+    explicit MappedFile(const char* path) {
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error(std::string("Can't open ") + path);
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize))
+        {
+            close();
+            throw std::runtime_error(std::string("Can't get the size of ") + path);
+        }
+        size = static_cast<size_t>(fileSize.QuadPart);
+        if (size == 0)
+        {
+            return; // An empty file can't be mapped and has nothing in it anyway
+        }
+
+
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        data = mapping ? static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+        if (data == nullptr)
+        {
+            close();
+            throw std::runtime_error(std::string("Can't map ") + path);
+        }
+    }
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+
+    const char* data = nullptr;
+    size_t size = 0;
+
+private:
+    void close() {
+        if (data != nullptr)
+        {
+            UnmapViewOfFile(data);
+            data = nullptr;
+        }
+        if (mapping != nullptr)
+        {
+            CloseHandle(mapping);
+            mapping = nullptr;
+        }
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        }
+    }
+
+
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+};
+
+
+// One level of detail of a mesh, a range of its index buffer
+struct MeshLod
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;          // Geometric error of the level in model units, 0 for the full mesh
+    uint32_t vertexCount; // The level only uses this many vertices, the first ones of the streams
+};
+
+
+// Cluster of at most maxMeshletVertices vertices and maxMeshletTriangles triangles of one level of detail, which is
+// culled as a whole. Its bounding sphere is kept in the meshlet sphere streams of the mesh
+struct Meshlet
+{
+    uint32_t positionOffset; // x, y and z streams of the meshlet's vertices in meshletPositions, each padded
+    uint32_t vertexCount;
+    uint32_t firstIndex;     // Triangles in meshletIndices, numbering the meshlet's own vertices
+    uint32_t indexCount;
+    glm::vec3 coneAxis;      // Every triangle faces away from a camera looking along the axis by more than the cutoff
+    float coneCutoff;        // 1 with a zero axis when the meshlet can't be culled for facing away
+};
+
+
+// Indexed triangle mesh. Every vertex is one combination of position, texture coordinate and normal, so a corner of
+// the cube that three faces use with three normals is three vertices. The mesh is read through the views at the top,
+// which point either into the storage vectors of a mesh built in memory or straight into a mapped mesh file
+struct Mesh
+{
+    VertexStreams positions;
+    VertexStreams normals;                                   // count is 0 when the model has no normals
+    const float* texCoordU = nullptr, * texCoordV = nullptr; // Null when the model has no texture coordinates
+    const unsigned int* indices = nullptr;                   // Every level of detail, one after the other
+    int indexCount = 0;
+    const MeshLod* lods = nullptr;                           // The full mesh first, then ever coarser levels
+    int lodCount = 0;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+
+
+    std::vector<float> streamStorage;
+    std::vector<unsigned int> indexStorage;
+    std::vector<MeshLod> lodStorage;
+    std::unique_ptr<MappedFile> file;
+
+
+    // Meshlets, read through views like the rest. Levels of detail with too few triangles have none
+    const Meshlet* meshlets = nullptr;
+    int meshletCount = 0;
+    const uint32_t* lodMeshletStart = nullptr; // The meshlets of level i run from lodMeshletStart[i] to lodMeshletStart[i + 1]
+    const float* meshletSphereX = nullptr, * meshletSphereY = nullptr, * meshletSphereZ = nullptr, * meshletSphereRadius = nullptr;
+    const float* meshletPositions = nullptr;
+    const unsigned int* meshletIndices = nullptr;
+
+
+    std::vector<Meshlet> meshletStorage;
+    std::vector<uint32_t> meshletStartStorage;
+    std::vector<float> meshletSphereStorage;
+    std::vector<float> meshletPositionStorage;
+    std::vector<unsigned int> meshletIndexStorage;
+};
+
+
+// Each meshlet sphere stream runs streamPadding floats past the last meshlet, so culling can read whole SIMD registers
+inline int meshletSphereLength(int meshletCount) {
+    return meshletCount + streamPadding;
+}
+
+
+inline int paddedStreamLength(int count) {
+    return (count + streamPadding - 1) / streamPadding * streamPadding;
+}
+
+
+// Lays the streams of a mesh built in memory out one after the other in streamStorage, positions first, then normals
+// and texture coordinates if the mesh has them, which is also their order in a mesh file. Returns the storage to fill
+// in, every stream is paddedStreamLength(vertexCount) floats long
+float* allocateMeshStreams(Mesh& mesh, int vertexCount, bool normals, bool texCoords) {
+    int length = paddedStreamLength(vertexCount);
+    int streamCount = 3 + (normals ? 3 : 0) + (texCoords ? 2 : 0);
+    mesh.streamStorage.assign(static_cast<size_t>(length) * streamCount, 0.0f);
+    float* stream = mesh.streamStorage.data();
+    mesh.positions = { vertexCount, stream, stream + length, stream + 2 * length };
+    stream += 3 * length;
+    if (normals)
+    {
+        mesh.normals = { vertexCount, stream, stream + length, stream + 2 * length };
+        stream += 3 * length;
+    }
+    if (texCoords)
+    {
+        mesh.texCoordU = stream;
+        mesh.texCoordV = stream + length;
+    }
+    return mesh.streamStorage.data();
+}
+
+
+// Points the index and level of detail views of a mesh built in memory at its storage, with the whole index buffer as
+// its one level of detail, and works out its bounds
+void finishMesh(Mesh& mesh) {
+    mesh.indices = mesh.indexStorage.data();
+    mesh.indexCount = static_cast<int>(mesh.indexStorage.size());
+    mesh.lodStorage.assign(1, MeshLod{ 0, static_cast<uint32_t>(mesh.indexCount), 0.0f, static_cast<uint32_t>(mesh.positions.count) });
+    mesh.lods = mesh.lodStorage.data();
+    mesh.lodCount = 1;
+
+
+    const VertexStreams& p = mesh.positions;
+    mesh.boundsMin = mesh.boundsMax = glm::vec3(0.0f);
+    if (p.count > 0)
+    {
+        mesh.boundsMin = mesh.boundsMax = glm::vec3(p.x[0], p.y[0], p.z[0]);
+    }
+    for (int i = 1; i < p.count; i++) {
+        mesh.boundsMin = glm::min(mesh.boundsMin, glm::vec3(p.x[i], p.y[i], p.z[i]));
+        mesh.boundsMax = glm::max(mesh.boundsMax, glm::vec3(p.x[i], p.y[i], p.z[i]));
+    }
+}
+
+
+// The built in cube, used when no model is given on the command line
+Mesh makeCubeMesh() {
+    Mesh mesh;
+    int vertexCount = sizeof(vertices) / sizeof(vertices[0]) / 3;
+    float* streams = allocateMeshStreams(mesh, vertexCount, false, false);
+    int length = paddedStreamLength(vertexCount);
+    for (int i = 0; i < vertexCount; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            streams[axis * length + i] = vertices[i * 3 + axis];
+        }
+    }
+    mesh.indexStorage.assign(indices, indices + sizeof(indices) / sizeof(indices[0]));
+    finishMesh(mesh);
+    return mesh;
+}
+
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+
+inline void skipSpaces(const char*& p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+}
+
+
+// Parses a decimal float like 1, -0.25, .5 or 1.5e-3 and moves p past it. The digits are gathered into an integer and
+// scaled by one power of ten at the end, which is exact for the usual up to 7 significant digits of an OBJ file and a
+// lot faster than strtof or a stream. Returns false and leaves p alone when there is no number at p
+bool parseFloat(const char*& p, const char* end, float& value) {
+    static const double powersOfTen[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                          1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    const char* s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+'))
+    {
+        negative = *s++ == '-';
+    }
+
+
+    // Digits past the 19th don't fit the mantissa and only move the decimal point
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool anyDigits = false;
+    for (; s < end && isDigit(*s); s++) {
+        anyDigits = true;
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*s - '0');
+            digits += (mantissa != 0) ? 1 : 0;
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+    if (s < end && *s == '.')
+    {
+        for (s++; s < end && isDigit(*s); s++) {
+            anyDigits = true;
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*s - '0');
+                digits += (mantissa != 0) ? 1 : 0;
+                exponent--;
+            }
+        }
+    }
+    if (!anyDigits)
+    {
+        return false;
+    }
+    if (s < end && (*s == 'e' || *s == 'E'))
+    {
+        const char* e = s + 1;
+        bool negativeExponent = false;
+        if (e < end && (*e == '-' || *e == '+'))
+        {
+            negativeExponent = *e++ == '-';
+        }
+        if (e < end && isDigit(*e))
+        {
+            int written = 0;
+            for (; e < end && isDigit(*e); e++) {
+                written = std::min(written * 10 + (*e - '0'), 1000);
+            }
+            exponent += negativeExponent ? -written : written;
+            s = e;
+        }
+    }
+
+
+    double result = static_cast<double>(mantissa);
+    if (exponent < 0)
+    {
+        result = (exponent >= -22) ? result / powersOfTen[-exponent] : result * std::pow(10.0, exponent);
+    }
+    else if (exponent > 0)
+    {
+        result = (exponent <= 22) ? result * powersOfTen[exponent] : result * std::pow(10.0, exponent);
+    }
+    value = static_cast<float>(negative ? -result : result);
+    p = s;
+    return true;
+}
+
+
+// Parses a signed decimal integer and moves p past it, returns false when there is none at p
+bool parseInt(const char*& p, const char* end, int& value) {
+    const char* s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+'))
+    {
+        negative = *s++ == '-';
+    }
+    if (s >= end || !isDigit(*s))
+    {
+        return false;
+    }
+    int64_t result = 0;
+    for (; s < end && isDigit(*s); s++) {
+        result = std::min<int64_t>(result * 10 + (*s - '0'), INT32_MAX);
+    }
+    value = static_cast<int>(negative ? -result : result);
+    p = s;
+    return true;
+}
+
+
+// One corner of a face as the file wrote it, position, texture coordinate and normal. Indices counted back from the
+// end (negative in the file) are relative to what has been read before the line, which a chunk can only know about
+// its own part of the file, so they are stored relative to the chunk and marked to get the chunk's offset added later
+struct ObjCorner
+{
+    int index[3];  // Zero based, or missingIndex
+    int relative;  // Bit k set when index[k] still needs the chunk offset of its kind
+};
+const int missingIndex = INT32_MIN;
+
+
+// What one thread got out of its part of the file
+struct ObjChunk
+{
+    std::vector<float> attributes[3]; // Positions (x y z), texture coordinates (u v) and normals (x y z), interleaved
+    std::vector<ObjCorner> corners;   // Three per triangle, faces with more corners are split into a fan
+    size_t errorOffset = SIZE_MAX;    // Offset into the file of the first line the chunk couldn't parse
+};
+const int objAttributeSizes[3] = { 3, 2, 3 };
+
+
+// Parses the lines from begin to end, which start at the beginning of a line and end after a newline or at the end
+// of the file. Only v, vt, vn and f lines matter for drawing, everything else is skipped
+void parseObjChunk(const char* fileStart, const char* begin, const char* end, ObjChunk& chunk) {
+    ObjCorner face[64];
+    const char* p = begin;
+    while (p < end) {
+        const char* line = p;
+        skipSpaces(p, end);
+        bool ok = true;
+        if (p + 1 < end && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            p += 1;
+            float value;
+            for (int i = 0; i < 3 && ok; i++) {
+                skipSpaces(p, end);
+                ok = parseFloat(p, end, value);
+                chunk.attributes[0].push_back(value);
+            }
+        }
+        else if (p + 2 < end && p[0] == 'v' && (p[1] == 't' || p[1] == 'n') && (p[2] == ' ' || p[2] == '\t'))
+        {
+            // A texture coordinate may leave out v, which is then 0
+            int kind = (p[1] == 't') ? 1 : 2;
+            p += 2;
+            float value;
+            for (int i = 0; i < objAttributeSizes[kind] && ok; i++) {
+                skipSpaces(p, end);
+                ok = parseFloat(p, end, value);
+                if (!ok && kind == 1 && i > 0)
+                {
+                    value = 0.0f;
+                    ok = true;
+                }
+                chunk.attributes[kind].push_back(value);
+            }
+        }
+        else if (p + 1 < end && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+        {
+            // Corners are v, v/vt, v//vn or v/vt/vn
+            p += 1;
+            int cornerCount = 0;
+            skipSpaces(p, end);
+            while (ok && p < end && *p != '\n' && *p != '\r' && *p != '#') {
+                ObjCorner corner = { { missingIndex, missingIndex, missingIndex }, 0 };
+                for (int kind = 0; kind < 3 && ok; kind++) {
+                    if (kind > 0)
+                    {
+                        if (p >= end || *p != '/')
+                        {
+                            break;
+                        }
+                        p++;
+                        if (kind == 1 && p < end && *p == '/')
+                        {
+                            continue; // v//vn has no texture coordinate
+                        }
+                    }
+                    int index;
+                    ok = parseInt(p, end, index) && index != 0;
+                    if (ok && index < 0)
+                    {
+                        corner.index[kind] = static_cast<int>(chunk.attributes[kind].size()) / objAttributeSizes[kind] + index;
+                        corner.relative |= 1 << kind;
+                    }
+                    else if (ok)
+                    {
+                        corner.index[kind] = index - 1;
+                    }
+                }
+                ok = ok && cornerCount < 64;
+                if (ok)
+                {
+                    face[cornerCount++] = corner;
+                }
+                skipSpaces(p, end);
+            }
+            ok = ok && cornerCount >= 3;
+            for (int i = 2; ok && i < cornerCount; i++) {
+                chunk.corners.push_back(face[0]);
+                chunk.corners.push_back(face[i - 1]);
+                chunk.corners.push_back(face[i]);
+            }
+        }
+        if (!ok && chunk.errorOffset == SIZE_MAX)
+        {
+            chunk.errorOffset = static_cast<size_t>(line - fileStart);
+        }
+
+
+        // On to the next line
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        p = newline ? newline + 1 : end;
+    }
+}
+
+
+// Open addressing hash table from a corner's position, texture coordinate and normal indices to the vertex made for
+// that combination. Linear probing over a power of two table at most half full. It starts out sized for the number
+// of vertices expected and doubles when it fills up, instead of making room for every corner up front
+class CornerTable
+{
+public:
+    explicit CornerTable(size_t expectedVertices) {
+        size_t capacity = 16;
+        while (capacity < expectedVertices * 2) {
+            capacity *= 2;
+        }
+        slots.assign(capacity, Slot{ { 0, 0, 0 }, -1 });
+        mask = capacity - 1;
+    }
+
+
+    // Returns the vertex of the combination, or -1 after remembering vertex as the new one for it
+    int findOrInsert(const int* key, int vertex) {
+        Slot& slot = find(key);
+        if (slot.vertex >= 0)
+        {
+            return slot.vertex;
+        }
+        if ((count + 1) * 2 > slots.size())
+        {
+            grow();
+            return findOrInsert(key, vertex);
+        }
+        std::memcpy(slot.key, key, sizeof(slot.key));
+        slot.vertex = vertex;
+        count++;
+        return -1;
+    }
+
+private:
+    struct Slot
+    {
+        int key[3];
+        int vertex;
+    };
+
+
+    // The slot holding the key, or the empty slot it would go in
+    Slot& find(const int* key) {
+        uint64_t hash = static_cast<uint32_t>(key[0]) * 0x9E3779B97F4A7C15ull;
+        hash ^= (static_cast<uint32_t>(key[1]) + (hash << 6) + (hash >> 2)) * 0xC2B2AE3D27D4EB4Full;
+        hash ^= (static_cast<uint32_t>(key[2]) + (hash << 6) + (hash >> 2)) * 0x165667B19E3779F9ull;
+        for (size_t i = (hash ^ (hash >> 32)) & mask;; i = (i + 1) & mask) {
+            Slot& slot = slots[i];
+            if (slot.vertex < 0 || (slot.key[0] == key[0] && slot.key[1] == key[1] && slot.key[2] == key[2]))
+            {
+                return slot;
+            }
+        }
+    }
+
+
+    void grow() {
+        std::vector<Slot> old(slots.size() * 2, Slot{ { 0, 0, 0 }, -1 });
+        old.swap(slots);
+        mask = slots.size() - 1;
+        for (const Slot& slot : old) {
+            if (slot.vertex >= 0)
+            {
+                find(slot.key) = slot;
+            }
+        }
+    }
+
+
+    std::vector<Slot> slots;
+    size_t mask;
+    size_t count = 0;
+};
+
+
+// Loads a Wavefront OBJ file. The file is mapped, cut into one chunk per core at line boundaries and the chunks are
+// parsed at the same time. The chunks are then joined in file order, and every distinct combination of position,
+// texture coordinate and normal becomes one vertex of the indexed mesh
+Mesh loadObj(const char* path) {
+    MappedFile file(path);
+    const char* start = file.data;
+    const char* end = file.data + file.size;
+
+
+    // Small files aren't worth the threads
+    const size_t minChunkSize = 1 << 20;
+    size_t chunkCount = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), file.size / minChunkSize));
+    std::vector<const char*> bounds(chunkCount + 1, end);
+    bounds[0] = start;
+    for (size_t i = 1; i < chunkCount; i++) {
+        const char* cut = std::max(bounds[i - 1], start + file.size / chunkCount * i);
+        const char* newline = static_cast<const char*>(std::memchr(cut, '\n', end - cut));
+        bounds[i] = newline ? newline + 1 : end;
+    }
+
+
+    // An exception can't leave a thread, it would end the program, so each chunk keeps its own and the first one is
+    // thrown again here once every parser has been joined. A parser that can't be started runs on this thread instead
+    std::vector<ObjChunk> chunks(chunkCount);
+    std::vector<std::exception_ptr> errors(chunkCount);
+    auto parse = [&](size_t i) {
+        try
+        {
+            parseObjChunk(start, bounds[i], bounds[i + 1], chunks[i]);
+        }
+        catch (...) {
+            errors[i] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> parsers;
+    parsers.reserve(chunkCount);
+    for (size_t i = 1; i < chunkCount; i++) {
+        try
+        {
+            parsers.emplace_back(parse, i);
+        }
+        catch (const std::system_error&) {
+            parse(i);
+        }
+    }
+    parse(0);
+    for (std::thread& parser : parsers) {
+        parser.join();
+    }
+    for (const std::exception_ptr& error : errors) {
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+    }
+
+
+    // Join the chunks. Every chunk's relative indices get the number of attributes of the chunks before it added
+    std::vector<float> attributes[3];
+    std::vector<ObjCorner> corners;
+    for (ObjChunk& chunk : chunks) {
+        if (chunk.errorOffset != SIZE_MAX)
+        {
+            throw std::runtime_error(std::string("Can't parse ") + path + " at byte " + std::to_string(chunk.errorOffset));
+        }
+        int base[3];
+        for (int kind = 0; kind < 3; kind++) {
+            base[kind] = static_cast<int>(attributes[kind].size()) / objAttributeSizes[kind];
+            attributes[kind].insert(attributes[kind].end(), chunk.attributes[kind].begin(), chunk.attributes[kind].end());
+            chunk.attributes[kind] = std::vector<float>();
+        }
+        for (ObjCorner corner : chunk.corners) {
+            for (int kind = 0; kind < 3; kind++) {
+                corner.index[kind] += (corner.relative & (1 << kind)) ? base[kind] : 0;
+            }
+            corners.push_back(corner);
+        }
+        chunk.corners = std::vector<ObjCorner>();
+    }
+
+
+    // Check every index. Faces may mix formats, a mesh has a texture coordinate or normal stream when any corner has
+    // one and the corners without it get one filled in below
+    int counts[3];
+    for (int kind = 0; kind < 3; kind++) {
+        counts[kind] = static_cast<int>(attributes[kind].size()) / objAttributeSizes[kind];
+    }
+    bool used[3] = { true, false, false };
+    for (const ObjCorner& corner : corners) {
+        for (int kind = 0; kind < 3; kind++) {
+            bool present = corner.index[kind] != missingIndex;
+            if ((kind == 0 && !present) || (present && (corner.index[kind] < 0 || corner.index[kind] >= counts[kind])))
+            {
+                throw std::runtime_error(std::string("Bad face index in ") + path);
+            }
+            used[kind] = used[kind] || present;
+        }
+    }
+
+
+    // Give every distinct corner a vertex. Without texture coordinates and normals a corner is just its position, so
+    // the positions are the vertices as they are
+    Mesh mesh;
+    mesh.indexStorage.resize(corners.size());
+    std::vector<int> sources[3];
+    if (!used[1] && !used[2])
+    {
+        for (size_t i = 0; i < corners.size(); i++) {
+            mesh.indexStorage[i] = static_cast<unsigned int>(corners[i].index[0]);
+        }
+        sources[0].resize(counts[0]);
+        for (int i = 0; i < counts[0]; i++) {
+            sources[0][i] = i;
+        }
+    }
+    else
+    {
+        CornerTable table(counts[0]); // Most models have about one vertex per position
+        for (size_t i = 0; i < corners.size(); i++) {
+            int vertex = table.findOrInsert(corners[i].index, static_cast<int>(sources[0].size()));
+            if (vertex < 0)
+            {
+                vertex = static_cast<int>(sources[0].size());
+                for (int kind = 0; kind < 3; kind++) {
+                    sources[kind].push_back(corners[i].index[kind]);
+                }
+            }
+            mesh.indexStorage[i] = static_cast<unsigned int>(vertex);
+        }
+    }
+
+
+    // Gather the attributes of every vertex into the streams
+    int vertexCount = static_cast<int>(sources[0].size());
+    int length = paddedStreamLength(vertexCount);
+    float* stream = allocateMeshStreams(mesh, vertexCount, used[2], used[1]);
+    for (int i = 0; i < vertexCount; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            stream[axis * length + i] = attributes[0][sources[0][i] * 3 + axis];
+        }
+    }
+    const float* positions = stream;
+    stream += 3 * length;
+    if (used[2])
+    {
+        // A corner without a normal gets the area weighted sum of the normals of the faces around its vertex
+        for (int i = 0; i < vertexCount; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                stream[axis * length + i] = (sources[2][i] != missingIndex) ? attributes[2][sources[2][i] * 3 + axis] : 0.0f;
+            }
+        }
+        for (size_t i = 0; i + 2 < corners.size(); i += 3) {
+            const unsigned int* triangle = &mesh.indexStorage[i];
+            glm::vec3 corner[3];
+            for (int k = 0; k < 3; k++) {
+                corner[k] = glm::vec3(positions[triangle[k]], positions[length + triangle[k]], positions[2 * length + triangle[k]]);
+            }
+            glm::vec3 faceNormal = glm::cross(corner[1] - corner[0], corner[2] - corner[0]);
+            for (int k = 0; k < 3; k++) {
+                if (sources[2][triangle[k]] == missingIndex)
+                {
+                    for (int axis = 0; axis < 3; axis++) {
+                        stream[axis * length + triangle[k]] += faceNormal[axis];
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < vertexCount; i++) {
+            if (sources[2][i] == missingIndex)
+            {
+                glm::vec3 normal(stream[i], stream[length + i], stream[2 * length + i]);
+                float size = glm::length(normal);
+                for (int axis = 0; axis < 3; axis++) {
+                    stream[axis * length + i] = (size > 0.0f) ? normal[axis] / size : 0.0f;
+                }
+            }
+        }
+        stream += 3 * length;
+    }
+    if (used[1])
+    {
+        // A corner without a texture coordinate gets (0, 0)
+        for (int i = 0; i < vertexCount; i++) {
+            bool present = sources[1][i] != missingIndex;
+            stream[i] = present ? attributes[1][sources[1][i] * 2] : 0.0f;
+            stream[length + i] = present ? attributes[1][sources[1][i] * 2 + 1] : 0.0f;
+        }
+    }
+    finishMesh(mesh);
+    return mesh;
+}
+
+
+// Error quadric of a set of planes, the sum of the squared distances of a point to them, each weighted by the area of
+// the triangle it came from. Only the upper triangle of the symmetric 4x4 matrix is kept. weight is the total area, so
+// the error divided by it is the mean squared distance
+struct Quadric
+{
+    double xx = 0.0, xy = 0.0, xz = 0.0, xw = 0.0, yy = 0.0, yz = 0.0, yw = 0.0, zz = 0.0, zw = 0.0, ww = 0.0;
+    double weight = 0.0;
+};
+
+
+// Adds the plane of the points p with dot(normal, p) + distance = 0, normal has to be unit length
+void addPlane(Quadric& q, const glm::dvec3& normal, double distance, double weight) {
+    q.xx += weight * normal.x * normal.x; q.xy += weight * normal.x * normal.y; q.xz += weight * normal.x * normal.z; q.xw += weight * normal.x * distance;
+    q.yy += weight * normal.y * normal.y; q.yz += weight * normal.y * normal.z; q.yw += weight * normal.y * distance;
+    q.zz += weight * normal.z * normal.z; q.zw += weight * normal.z * distance;
+    q.ww += weight * distance * distance;
+    q.weight += weight;
+}
+
+
+Quadric addQuadrics(const Quadric& a, const Quadric& b) {
+    Quadric q;
+    q.xx = a.xx + b.xx; q.xy = a.xy + b.xy; q.xz = a.xz + b.xz; q.xw = a.xw + b.xw;
+    q.yy = a.yy + b.yy; q.yz = a.yz + b.yz; q.yw = a.yw + b.yw;
+    q.zz = a.zz + b.zz; q.zw = a.zw + b.zw;
+    q.ww = a.ww + b.ww;
+    q.weight = a.weight + b.weight;
+    return q;
+}
+
+
+// Mean squared distance of p to the planes of q
+double quadricError(const Quadric& q, const glm::dvec3& p) {
+    double error = q.xx * p.x * p.x + 2.0 * (q.xy * p.x * p.y + q.xz * p.x * p.z + q.xw * p.x) +
+                   q.yy * p.y * p.y + 2.0 * (q.yz * p.y * p.z + q.yw * p.y) +
+                   q.zz * p.z * p.z + 2.0 * q.zw * p.z + q.ww;
+    return q.weight > 0.0 ? std::max(error, 0.0) / q.weight : 0.0;
+}
+
+
+// Weight of the planes standing up from border edges, against the area weight of the triangle planes
+const double lodBorderWeight = 10.0;
+
+
+// Quadric error simplification by edge collapse. Every collapse moves a vertex onto one of its neighbours, so the
+// simplified triangles index the vertices of the mesh as they are and every level shares its streams. The vertices
+// have to be welded, one index per position, or the seams between texture coordinates and normals tear open.
+// Works in passes: a pass weighs every edge by the error of collapsing it in the cheaper direction, then collapses the
+// cheapest edges whose triangles no other collapse of the pass has touched, and drops the triangles that collapsed.
+// Border edges get planes standing up from them so open edges keep their outline, a border vertex only moves along
+// its border, and a collapse that would turn a triangle over is skipped. Stops at targetIndexCount indices or when no
+// edge can go. Returns the largest error of the collapses, as a distance in model units
+float simplifyMesh(const VertexStreams& positions, std::vector<unsigned int>& indices, size_t targetIndexCount) {
+    int vertexCount = positions.count;
+    auto position = [&](unsigned int vertex) { return glm::dvec3(positions.x[vertex], positions.y[vertex], positions.z[vertex]); };
+
+
+    // Quadrics of the triangle planes, the border planes are added with the first edge list below
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        glm::dvec3 p0 = position(indices[i]), p1 = position(indices[i + 1]), p2 = position(indices[i + 2]);
+        glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+        double length = glm::length(normal);
+        if (length > 0.0)
+        {
+            normal /= length;
+            for (int corner = 0; corner < 3; corner++) {
+                addPlane(quadrics[indices[i + corner]], normal, -glm::dot(normal, p0), 0.5 * length);
+            }
+        }
+    }
+
+
+    struct Collapse
+    {
+        unsigned int from, to;
+        double cost;
+    };
+    std::vector<uint64_t> edges;
+    std::vector<char> borderEdges;
+    std::vector<Collapse> collapses;
+    std::vector<char> border(vertexCount), locked(vertexCount);
+    std::vector<unsigned int> remap(vertexCount);
+    std::vector<int> adjacencyStart(vertexCount + 1);
+    std::vector<int> adjacency;
+    double maxCost = 0.0;
+    for (bool firstPass = true; indices.size() > targetIndexCount; firstPass = false) {
+        // Every edge once as lower vertex << 32 | higher vertex. An edge only one triangle has is on the border, one
+        // that more than two triangles share is treated the same so the surface isn't pinched there
+        edges.clear();
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            for (int corner = 0; corner < 3; corner++) {
+                unsigned int a = indices[i + corner], b = indices[i + (corner + 1) % 3];
+                edges.push_back(static_cast<uint64_t>(std::min(a, b)) << 32 | std::max(a, b));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        std::fill(border.begin(), border.end(), 0);
+        borderEdges.clear();
+        size_t uniqueEdges = 0;
+        for (size_t i = 0; i < edges.size();) {
+            size_t run = i + 1;
+            while (run < edges.size() && edges[run] == edges[i]) {
+                run++;
+            }
+            bool borderEdge = run - i != 2;
+            unsigned int a = static_cast<unsigned int>(edges[i] >> 32), b = static_cast<unsigned int>(edges[i]);
+            if (borderEdge)
+            {
+                border[a] = border[b] = 1;
+            }
+            edges[uniqueEdges++] = edges[i];
+            borderEdges.push_back(borderEdge);
+            i = run;
+        }
+        edges.resize(uniqueEdges);
+
+
+        if (firstPass)
+        {
+            for (size_t i = 0; i < indices.size(); i += 3) {
+                glm::dvec3 p[3] = { position(indices[i]), position(indices[i + 1]), position(indices[i + 2]) };
+                glm::dvec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+                for (int corner = 0; corner < 3; corner++) {
+                    unsigned int a = indices[i + corner], b = indices[i + (corner + 1) % 3];
+                    uint64_t edge = static_cast<uint64_t>(std::min(a, b)) << 32 | std::max(a, b);
+                    if (!borderEdges[std::lower_bound(edges.begin(), edges.end(), edge) - edges.begin()])
+                    {
+                        continue;
+                    }
+                    glm::dvec3 along = p[(corner + 1) % 3] - p[corner];
+                    glm::dvec3 out = glm::cross(along, normal);
+                    double length = glm::length(out);
+                    if (length > 0.0)
+                    {
+                        out /= length;
+                        double weight = lodBorderWeight * glm::dot(along, along);
+                        addPlane(quadrics[a], out, -glm::dot(out, p[corner]), weight);
+                        addPlane(quadrics[b], out, -glm::dot(out, p[corner]), weight);
+                    }
+                }
+            }
+        }
+
+
+        // Triangles around every vertex
+        std::fill(adjacencyStart.begin(), adjacencyStart.end(), 0);
+        for (unsigned int vertex : indices) {
+            adjacencyStart[vertex + 1]++;
+        }
+        for (int vertex = 0; vertex < vertexCount; vertex++) {
+            adjacencyStart[vertex + 1] += adjacencyStart[vertex];
+        }
+        adjacency.resize(indices.size());
+        {
+            std::vector<int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+            for (size_t i = 0; i < indices.size(); i++) {
+                adjacency[fill[indices[i]]++] = static_cast<int>(i / 3);
+            }
+        }
+
+
+        // Cheaper direction of every edge. A border vertex only collapses along a border edge into another border vertex
+        collapses.clear();
+        for (size_t i = 0; i < edges.size(); i++) {
+            bool borderEdge = borderEdges[i] != 0;
+            unsigned int a = static_cast<unsigned int>(edges[i] >> 32), b = static_cast<unsigned int>(edges[i]);
+            Quadric q = addQuadrics(quadrics[a], quadrics[b]);
+            bool aToB = !border[a] || (borderEdge && border[b]);
+            bool bToA = !border[b] || (borderEdge && border[a]);
+            double costAToB = aToB ? quadricError(q, position(b)) : HUGE_VAL;
+            double costBToA = bToA ? quadricError(q, position(a)) : HUGE_VAL;
+            if (aToB || bToA)
+            {
+                collapses.push_back(costAToB <= costBToA ? Collapse{ a, b, costAToB } : Collapse{ b, a, costBToA });
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+
+        // Collapse the cheapest edges. Each collapse removes about two triangles, and locking every vertex of the
+        // triangles around a collapse keeps the adjacency of the pass right for the ones after it
+        for (int vertex = 0; vertex < vertexCount; vertex++) {
+            remap[vertex] = static_cast<unsigned int>(vertex);
+        }
+        std::fill(locked.begin(), locked.end(), 0);
+        size_t wanted = (indices.size() - targetIndexCount) / 6 + 1;
+        size_t done = 0;
+        for (const Collapse& collapse : collapses) {
+            if (done == wanted)
+            {
+                break;
+            }
+            if (locked[collapse.from] || locked[collapse.to])
+            {
+                continue;
+            }
+
+
+            glm::dvec3 target = position(collapse.to);
+            bool flips = false;
+            for (int k = adjacencyStart[collapse.from]; k < adjacencyStart[collapse.from + 1] && !flips; k++) {
+                const unsigned int* triangle = &indices[adjacency[k] * 3];
+                if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+                {
+                    continue; // Collapses with the edge
+                }
+                glm::dvec3 before[3], after[3];
+                for (int corner = 0; corner < 3; corner++) {
+                    before[corner] = position(triangle[corner]);
+                    after[corner] = (triangle[corner] == collapse.from) ? target : before[corner];
+                }
+                flips = glm::dot(glm::cross(before[1] - before[0], before[2] - before[0]), glm::cross(after[1] - after[0], after[2] - after[0])) <= 0.0;
+            }
+            if (flips)
+            {
+                continue;
+            }
+
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to] = addQuadrics(quadrics[collapse.to], quadrics[collapse.from]);
+            for (int k = adjacencyStart[collapse.from]; k < adjacencyStart[collapse.from + 1]; k++) {
+                for (int corner = 0; corner < 3; corner++) {
+                    locked[indices[adjacency[k] * 3 + corner]] = 1;
+                }
+            }
+            maxCost = std::max(maxCost, collapse.cost);
+            done++;
+        }
+
+
+        // Move the collapsed vertices and drop the triangles that lost their area
+        size_t kept = 0;
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            unsigned int a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (a != b && b != c && a != c)
+            {
+                indices[kept++] = a;
+                indices[kept++] = b;
+                indices[kept++] = c;
+            }
+        }
+        indices.resize(kept);
+
+
+        // A pass that only finds a few of the collapses it wanted is down to the parts of the mesh that can't go, like
+        // a soup of unconnected triangles, and the passes after it would take long for little
+        if (done * 8 < wanted)
+        {
+            break;
+        }
+    }
+    return static_cast<float>(std::sqrt(maxCost));
+}
+
+
+// Maps every vertex to the lowest numbered vertex at the same position, which welds together the vertices that only
+// differ in their normal or texture coordinate
+std::vector<unsigned int> weldPositions(const VertexStreams& p) {
+    std::vector<unsigned int> order(p.count), welded(p.count);
+    for (int vertex = 0; vertex < p.count; vertex++) {
+        order[vertex] = static_cast<unsigned int>(vertex);
+    }
+    auto samePosition = [&](unsigned int a, unsigned int b) { return p.x[a] == p.x[b] && p.y[a] == p.y[b] && p.z[a] == p.z[b]; };
+    std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+        return std::tie(p.x[a], p.y[a], p.z[a], a) < std::tie(p.x[b], p.y[b], p.z[b], b);
+    });
+    for (int i = 0; i < p.count; i++) {
+        welded[order[i]] = (i > 0 && samePosition(order[i], order[i - 1])) ? welded[order[i - 1]] : order[i];
+    }
+    return welded;
+}
+
+
+// Levels of detail of a mesh. Each level aims at half the triangles of the one before, and the chain ends when a level
+// can't get below three quarters of them or would have fewer than minLodTriangles
+const int maxLodCount = 8;
+const size_t minLodTriangles = 32;
+
+
+// Builds the level of detail chain of a mesh made in memory. Every level is simplified from the one before and its
+// error adds onto theirs. The vertices are then sorted so the ones the coarsest level uses come first, then the ones
+// the level before it adds and so on, so a level only has to transform the first vertexCount vertices of the streams
+void buildMeshLods(Mesh& mesh) {
+    assert(!mesh.file);
+    int vertexCount = mesh.positions.count;
+
+
+    std::vector<unsigned int> welded = weldPositions(mesh.positions);
+
+
+    std::vector<std::vector<unsigned int>> levels(1, std::vector<unsigned int>(mesh.indices, mesh.indices + mesh.indexCount));
+    std::vector<float> errors(1, 0.0f);
+    std::vector<unsigned int> current;
+    for (size_t i = 0; i + 2 < levels[0].size(); i += 3) {
+        unsigned int a = welded[levels[0][i]], b = welded[levels[0][i + 1]], c = welded[levels[0][i + 2]];
+        if (a != b && b != c && a != c)
+        {
+            current.insert(current.end(), { a, b, c }); // Triangles that weld into a line or a point have nothing to keep
+        }
+    }
+    while (static_cast<int>(levels.size()) < maxLodCount && current.size() / 3 >= 2 * minLodTriangles) {
+        size_t before = current.size();
+        float error = simplifyMesh(mesh.positions, current, before / 6 * 3);
+        if (current.size() > before / 4 * 3)
+        {
+            break;
+        }
+        levels.push_back(current);
+        errors.push_back(errors.back() + error);
+    }
+    if (levels.size() == 1)
+    {
+        return;
+    }
+
+
+    // Order the vertices by the coarsest level that uses them, a stable counting sort so each group keeps its order
+    int levelCount = static_cast<int>(levels.size());
+    std::vector<int> coarsest(vertexCount, 0);
+    for (int level = 1; level < levelCount; level++) {
+        for (unsigned int vertex : levels[level]) {
+            coarsest[vertex] = level;
+        }
+    }
+    std::vector<int> levelStart(levelCount + 1, 0);
+    for (int vertex = 0; vertex < vertexCount; vertex++) {
+        levelStart[levelCount - coarsest[vertex]]++;
+    }
+    for (int group = 0; group < levelCount; group++) {
+        levelStart[group + 1] += levelStart[group];
+    }
+    std::vector<unsigned int> newIndex(vertexCount);
+    for (int vertex = 0; vertex < vertexCount; vertex++) {
+        newIndex[vertex] = static_cast<unsigned int>(levelStart[levelCount - 1 - coarsest[vertex]]++);
+    }
+
+
+    // Move the streams into the new order. allocateMeshStreams lays out the same streams again
+    int length = paddedStreamLength(vertexCount);
+    std::vector<float> oldStreams = std::move(mesh.streamStorage);
+    size_t streamCount = oldStreams.size() / length;
+    float* streams = allocateMeshStreams(mesh, vertexCount, mesh.normals.count > 0, mesh.texCoordU != nullptr);
+    for (size_t stream = 0; stream < streamCount; stream++) {
+        for (int vertex = 0; vertex < vertexCount; vertex++) {
+            streams[stream * length + newIndex[vertex]] = oldStreams[stream * length + vertex];
+        }
+    }
+
+
+    mesh.indexStorage.clear();
+    mesh.lodStorage.clear();
+    for (int level = 0; level < levelCount; level++) {
+        uint32_t levelVertices = 0;
+        for (int vertex = 0; vertex < vertexCount; vertex++) {
+            levelVertices += (coarsest[vertex] >= level) ? 1 : 0;
+        }
+        mesh.lodStorage.push_back({ static_cast<uint32_t>(mesh.indexStorage.size()), static_cast<uint32_t>(levels[level].size()), errors[level], levelVertices });
+        for (unsigned int vertex : levels[level]) {
+            mesh.indexStorage.push_back(newIndex[vertex]);
+        }
+    }
+    mesh.indices = mesh.indexStorage.data();
+    mesh.indexCount = static_cast<int>(mesh.indexStorage.size());
+    mesh.lods = mesh.lodStorage.data();
+    mesh.lodCount = levelCount;
+}
+
+
+// Meshlets are small clusters of a level of detail, sized so their transformed vertices stay in the L1 cache and so a
+// 64 vertex cluster with the usual two triangles per vertex fits in one
+const int maxMeshletVertices = 64;
+const int maxMeshletTriangles = 124;
+
+
+// True when every edge of the triangles is shared by exactly two of them that run along it in opposite directions, so
+// the surface is closed and wound the same way all over. indices have to be welded
+bool closedSurface(const std::vector<unsigned int>& indices) {
+    std::vector<uint64_t> edges;
+    edges.reserve(indices.size());
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        for (int corner = 0; corner < 3; corner++) {
+            edges.push_back(static_cast<uint64_t>(indices[i + corner]) << 32 | indices[i + (corner + 1) % 3]);
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size(); i++) {
+        uint64_t reverse = edges[i] << 32 | edges[i] >> 32;
+        if ((i > 0 && edges[i] == edges[i - 1]) || !std::binary_search(edges.begin(), edges.end(), reverse))
+        {
+            return false;
+        }
+    }
+    return !edges.empty();
+}
+
+
+// Splits every level of detail with at least two meshlets worth of triangles into meshlets. A meshlet grows from a
+// triangle by taking, out of the triangles around the vertices it has, the one that adds the fewest new vertices,
+// until it runs out of vertices or triangles or the neighbours are used up. Each meshlet keeps a copy of its vertex
+// positions as padded streams of its own and its indices numbered within it, so the vertex stage can run on it alone.
+// A normal cone is only set up on the levels that are closed surfaces, the back faces of anything else can be seen.
+// Runs when a model is converted, mesh files keep the meshlets
+void buildMeshlets(Mesh& mesh) {
+    int vertexCount = mesh.positions.count;
+    const VertexStreams& p = mesh.positions;
+    auto position = [&](unsigned int vertex) { return glm::vec3(p.x[vertex], p.y[vertex], p.z[vertex]); };
+    std::vector<unsigned int> welded = weldPositions(p);
+    std::vector<int> localIndex(vertexCount, -1);
+    std::vector<int> adjacencyStart, adjacency;
+    std::vector<char> used;
+    std::vector<int> candidates;
+    std::vector<unsigned int> meshletVertices;
+    std::vector<Meshlet>& meshlets = mesh.meshletStorage;
+    std::vector<uint32_t>& starts = mesh.meshletStartStorage;
+    std::vector<float> sphereX, sphereY, sphereZ, sphereRadius;
+    std::vector<float>& positions = mesh.meshletPositionStorage;
+    std::vector<unsigned int>& meshletIndices = mesh.meshletIndexStorage;
+
+
+    meshlets.clear();
+    starts.assign(1, 0);
+    positions.clear();
+    meshletIndices.clear();
+    for (int level = 0; level < mesh.lodCount; level++) {
+        const MeshLod& lod = mesh.lods[level];
+        const unsigned int* indices = mesh.indices + lod.firstIndex;
+        int triangleCount = static_cast<int>(lod.indexCount / 3);
+        if (triangleCount < 2 * maxMeshletTriangles)
+        {
+            starts.push_back(static_cast<uint32_t>(meshlets.size()));
+            continue;
+        }
+
+
+        // Which side the normals face. On a closed surface the signed volume says if the triangles wind outwards
+        std::vector<unsigned int> weldedIndices;
+        for (uint32_t i = 0; i < lod.indexCount; i += 3) {
+            unsigned int a = welded[indices[i]], b = welded[indices[i + 1]], c = welded[indices[i + 2]];
+            if (a != b && b != c && a != c)
+            {
+                weldedIndices.insert(weldedIndices.end(), { a, b, c });
+            }
+        }
+        float facing = 0.0f;
+        if (closedSurface(weldedIndices))
+        {
+            float volume = 0.0f;
+            for (int triangle = 0; triangle < triangleCount; triangle++) {
+                const unsigned int* corners = &indices[triangle * 3];
+                volume += glm::dot(position(corners[0]), glm::cross(position(corners[1]), position(corners[2])));
+            }
+            facing = (volume >= 0.0f) ? 1.0f : -1.0f;
+        }
+
+
+        // Triangles around every vertex
+        adjacencyStart.assign(vertexCount + 1, 0);
+        for (uint32_t i = 0; i < lod.indexCount; i++) {
+            adjacencyStart[indices[i] + 1]++;
+        }
+        for (int vertex = 0; vertex < vertexCount; vertex++) {
+            adjacencyStart[vertex + 1] += adjacencyStart[vertex];
+        }
+        adjacency.resize(lod.indexCount);
+        {
+            std::vector<int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+            for (uint32_t i = 0; i < lod.indexCount; i++) {
+                adjacency[fill[indices[i]]++] = static_cast<int>(i / 3);
+            }
+        }
+
+
+        used.assign(triangleCount, 0);
+        int nextSeed = 0;
+        while (true) {
+            while (nextSeed < triangleCount && used[nextSeed]) {
+                nextSeed++;
+            }
+            if (nextSeed == triangleCount)
+            {
+                break;
+            }
+
+
+            Meshlet meshlet = {};
+            meshlet.firstIndex = static_cast<uint32_t>(meshletIndices.size());
+            meshletVertices.clear();
+            candidates.assign(1, nextSeed);
+            int meshletTriangles = 0;
+            while (meshletTriangles < maxMeshletTriangles) {
+                // The unused candidate that adds the fewest vertices, the first of them on a tie
+                int best = -1, bestNew = 4;
+                for (int candidate : candidates) {
+                    if (used[candidate])
+                    {
+                        continue;
+                    }
+                    const unsigned int* corners = &indices[candidate * 3];
+                    int added = (localIndex[corners[0]] < 0) + (localIndex[corners[1]] < 0) + (localIndex[corners[2]] < 0);
+                    if (added < bestNew)
+                    {
+                        best = candidate;
+                        bestNew = added;
+                    }
+                }
+                if (best < 0 || static_cast<int>(meshletVertices.size()) + bestNew > maxMeshletVertices)
+                {
+                    break;
+                }
+
+
+                used[best] = 1;
+                meshletTriangles++;
+                for (int corner = 0; corner < 3; corner++) {
+                    unsigned int vertex = indices[best * 3 + corner];
+                    if (localIndex[vertex] < 0)
+                    {
+                        localIndex[vertex] = static_cast<int>(meshletVertices.size());
+                        meshletVertices.push_back(vertex);
+                        for (int k = adjacencyStart[vertex]; k < adjacencyStart[vertex + 1]; k++) {
+                            if (!used[adjacency[k]])
+                            {
+                                candidates.push_back(adjacency[k]);
+                            }
+                        }
+                    }
+                    meshletIndices.push_back(static_cast<unsigned int>(localIndex[vertex]));
+                }
+                candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](int candidate) { return used[candidate] != 0; }), candidates.end());
+            }
+            meshlet.indexCount = static_cast<uint32_t>(meshletTriangles * 3);
+            meshlet.vertexCount = static_cast<uint32_t>(meshletVertices.size());
+
+
+            // Positions as the meshlet's own padded streams
+            int length = paddedStreamLength(static_cast<int>(meshletVertices.size()));
+            meshlet.positionOffset = static_cast<uint32_t>(positions.size());
+            positions.resize(positions.size() + 3 * length, 0.0f);
+            float* stream = &positions[meshlet.positionOffset];
+            glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+            for (size_t i = 0; i < meshletVertices.size(); i++) {
+                glm::vec3 v = position(meshletVertices[i]);
+                stream[i] = v.x;
+                stream[length + i] = v.y;
+                stream[2 * length + i] = v.z;
+                boundsMin = glm::min(boundsMin, v);
+                boundsMax = glm::max(boundsMax, v);
+            }
+
+
+            // Bounding sphere around the centre of the bounds
+            glm::vec3 center = 0.5f * (boundsMin + boundsMax);
+            float radius = 0.0f;
+            for (unsigned int vertex : meshletVertices) {
+                radius = std::max(radius, glm::length(position(vertex) - center));
+            }
+            sphereX.push_back(center.x);
+            sphereY.push_back(center.y);
+            sphereZ.push_back(center.z);
+            sphereRadius.push_back(radius);
+
+
+            // Normal cone. The axis is the mean of the triangle normals, and the cutoff is the sine of the widest
+            // angle a normal makes with it. A cone of 90 degrees or more can't be back facing as a whole
+            meshlet.coneAxis = glm::vec3(0.0f);
+            meshlet.coneCutoff = 1.0f;
+            if (facing != 0.0f)
+            {
+                glm::vec3 normals[maxMeshletTriangles];
+                glm::vec3 sum(0.0f);
+                int normalCount = 0;
+                for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i += 3) {
+                    glm::vec3 a = position(meshletVertices[meshletIndices[i]]);
+                    glm::vec3 normal = glm::cross(position(meshletVertices[meshletIndices[i + 1]]) - a, position(meshletVertices[meshletIndices[i + 2]]) - a);
+                    float length = glm::length(normal);
+                    if (length > 0.0f)
+                    {
+                        normals[normalCount++] = normal * (facing / length);
+                        sum += normals[normalCount - 1];
+                    }
+                }
+                float sumLength = glm::length(sum);
+                if (sumLength > 0.0f)
+                {
+                    glm::vec3 axis = sum / sumLength;
+                    float minDot = 1.0f;
+                    for (int i = 0; i < normalCount; i++) {
+                        minDot = std::min(minDot, glm::dot(axis, normals[i]));
+                    }
+                    if (minDot > 0.0f)
+                    {
+                        meshlet.coneAxis = axis;
+                        meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+                    }
+                }
+            }
+
+
+            for (unsigned int vertex : meshletVertices) {
+                localIndex[vertex] = -1;
+            }
+            meshlets.push_back(meshlet);
+        }
+        starts.push_back(static_cast<uint32_t>(meshlets.size()));
+    }
+
+
+    // The sphere streams one after the other, each with its padding
+    int meshletCount = static_cast<int>(meshlets.size());
+    int sphereLength = meshletSphereLength(meshletCount);
+    mesh.meshletSphereStorage.assign(4 * sphereLength, 0.0f);
+    float* spheres = mesh.meshletSphereStorage.data();
+    std::copy(sphereX.begin(), sphereX.end(), spheres);
+    std::copy(sphereY.begin(), sphereY.end(), spheres + sphereLength);
+    std::copy(sphereZ.begin(), sphereZ.end(), spheres + 2 * sphereLength);
+    std::copy(sphereRadius.begin(), sphereRadius.end(), spheres + 3 * sphereLength);
+
+
+    mesh.meshlets = meshlets.data();
+    mesh.meshletCount = meshletCount;
+    mesh.lodMeshletStart = starts.data();
+    mesh.meshletSphereX = spheres;
+    mesh.meshletSphereY = spheres + sphereLength;
+    mesh.meshletSphereZ = spheres + 2 * sphereLength;
+    mesh.meshletSphereRadius = spheres + 3 * sphereLength;
+    mesh.meshletPositions = positions.data();
+    mesh.meshletIndices = meshletIndices.data();
+}
+
+
+// Binary mesh file. The header is followed by the vertex streams, the index buffer, the level of detail table and the
+// meshlet tables, each starting on a 64 byte boundary, so a mapped file can be drawn from as it is: the streams are
+// already padded and aligned for the vertex stage and nothing is parsed, copied or built. Numbers are stored little
+// endian, as every machine this runs on has them. Any change to the layout has to bump meshFileVersion, files of other
+// versions are rebuilt
+const char meshFileMagic[8] = { 'A', 'S', 'C', 'I', 'I', 'M', 'S', 'H' };
+const uint32_t meshFileVersion = 3;
+const uint32_t meshFileAlignment = 64;
+const uint32_t meshFileHasNormals = 1;
+const uint32_t meshFileHasTexCoords = 2;
+
+
+struct MeshFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t fileSize;
+    uint64_t sourceHash;     // Hash of the file the mesh was converted from, 0 if there was none
+    uint32_t vertexCount;
+    uint32_t streamLength;   // Floats in each stream, vertexCount padded to a multiple of streamPadding
+    uint32_t indexCount;
+    uint32_t lodCount;
+    uint32_t flags;          // meshFileHasNormals and meshFileHasTexCoords
+    uint32_t meshletCount;
+    uint32_t meshletPositionCount;
+    uint32_t meshletIndexCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    uint64_t streamsOffset;  // Positions x y z, then normals x y z and texture coordinates u v if the flags say so
+    uint64_t indicesOffset;
+    uint64_t lodsOffset;
+    uint64_t meshletStartsOffset;    // lodCount + 1 entries
+    uint64_t meshletsOffset;
+    uint64_t meshletSpheresOffset;   // x y z and radius, each meshletSphereLength floats
+    uint64_t meshletPositionsOffset;
+    uint64_t meshletIndicesOffset;
+};
+
+
+static_assert(sizeof(MeshFileHeader) == 152 && sizeof(MeshLod) == 16 && sizeof(Meshlet) == 32, "The mesh file layout is fixed");
+
+
+inline uint64_t alignMeshFileOffset(uint64_t offset) {
+    return (offset + meshFileAlignment - 1) / meshFileAlignment * meshFileAlignment;
+}
+
+
+// 64 bit hash of a block of memory, eight bytes per step so hashing a large model costs about as much as reading it
+uint64_t hashBytes(const char* data, size_t size) {
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ (size * 0xC2B2AE3D27D4EB4Full);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        hash = (hash ^ (word * 0xC2B2AE3D27D4EB4Full)) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, data + i, size - i);
+    hash = (hash ^ (tail * 0xC2B2AE3D27D4EB4Full)) * 0x9E3779B97F4A7C15ull;
+
+
+    // Final mix so every input bit reaches every output bit
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+
+// Writes a mesh in the binary format. The file is written under a temporary name and renamed into place, so a reader
+// never sees half a file
+void writeMeshFile(const Mesh& mesh, uint64_t sourceHash, const char* path) {
+    int vertexCount = mesh.positions.count;
+    int length = paddedStreamLength(vertexCount);
+    bool hasNormals = mesh.normals.count > 0;
+    bool hasTexCoords = mesh.texCoordU != nullptr;
+    const float* streams[8] = { mesh.positions.x, mesh.positions.y, mesh.positions.z };
+    int streamCount = 3;
+    if (hasNormals)
+    {
+        streams[streamCount++] = mesh.normals.x; streams[streamCount++] = mesh.normals.y; streams[streamCount++] = mesh.normals.z;
+    }
+    if (hasTexCoords)
+    {
+        streams[streamCount++] = mesh.texCoordU; streams[streamCount++] = mesh.texCoordV;
+    }
+
+
+    MeshFileHeader header = {};
+    std::memcpy(header.magic, meshFileMagic, sizeof(header.magic));
+    header.version = meshFileVersion;
+    header.headerSize = sizeof(MeshFileHeader);
+    header.sourceHash = sourceHash;
+    header.vertexCount = static_cast<uint32_t>(vertexCount);
+    header.streamLength = static_cast<uint32_t>(length);
+    header.indexCount = static_cast<uint32_t>(mesh.indexCount);
+    header.lodCount = static_cast<uint32_t>(mesh.lodCount);
+    header.flags = (hasNormals ? meshFileHasNormals : 0) | (hasTexCoords ? meshFileHasTexCoords : 0);
+    header.meshletCount = static_cast<uint32_t>(mesh.meshletCount);
+    header.meshletPositionCount = static_cast<uint32_t>(mesh.meshletPositionStorage.size());
+    header.meshletIndexCount = static_cast<uint32_t>(mesh.meshletIndexStorage.size());
+    for (int axis = 0; axis < 3; axis++) {
+        header.boundsMin[axis] = mesh.boundsMin[axis];
+        header.boundsMax[axis] = mesh.boundsMax[axis];
+    }
+    header.streamsOffset = alignMeshFileOffset(sizeof(MeshFileHeader));
+    header.indicesOffset = alignMeshFileOffset(header.streamsOffset + static_cast<uint64_t>(length) * streamCount * sizeof(float));
+    header.lodsOffset = alignMeshFileOffset(header.indicesOffset + static_cast<uint64_t>(mesh.indexCount) * sizeof(unsigned int));
+    header.meshletStartsOffset = alignMeshFileOffset(header.lodsOffset + static_cast<uint64_t>(mesh.lodCount) * sizeof(MeshLod));
+    header.meshletsOffset = alignMeshFileOffset(header.meshletStartsOffset + static_cast<uint64_t>(mesh.lodCount + 1) * sizeof(uint32_t));
+    header.meshletSpheresOffset = alignMeshFileOffset(header.meshletsOffset + static_cast<uint64_t>(header.meshletCount) * sizeof(Meshlet));
+    header.meshletPositionsOffset = alignMeshFileOffset(header.meshletSpheresOffset + 4ull * meshletSphereLength(mesh.meshletCount) * sizeof(float));
+    header.meshletIndicesOffset = alignMeshFileOffset(header.meshletPositionsOffset + static_cast<uint64_t>(header.meshletPositionCount) * sizeof(float));
+    header.fileSize = header.meshletIndicesOffset + static_cast<uint64_t>(header.meshletIndexCount) * sizeof(unsigned int);
+
+
+    std::string temporaryPath = std::string(path) + ".tmp";
+    HANDLE file = CreateFileA(temporaryPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error("Can't create " + temporaryPath);
+    }
+    uint64_t written = 0;
+    bool ok = true;
+    auto write = [&](const void* data, uint64_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (ok && size > 0) {
+            DWORD chunk = static_cast<DWORD>(std::min<uint64_t>(size, 1u << 30));
+            DWORD done = 0;
+            ok = WriteFile(file, bytes, chunk, &done, nullptr) && done == chunk;
+            bytes += chunk;
+            size -= chunk;
+            written += chunk;
+        }
+    };
+    auto padTo = [&](uint64_t offset) {
+        static const char zeros[meshFileAlignment] = {};
+        write(zeros, offset - written);
+    };
+    write(&header, sizeof(header));
+    padTo(header.streamsOffset);
+    for (int i = 0; i < streamCount; i++) {
+        write(streams[i], static_cast<uint64_t>(length) * sizeof(float)); // The padding floats of the views are zeros too
+    }
+    padTo(header.indicesOffset);
+    write(mesh.indices, static_cast<uint64_t>(mesh.indexCount) * sizeof(unsigned int));
+    padTo(header.lodsOffset);
+    write(mesh.lods, static_cast<uint64_t>(mesh.lodCount) * sizeof(MeshLod));
+    padTo(header.meshletStartsOffset);
+    write(mesh.lodMeshletStart, static_cast<uint64_t>(mesh.lodCount + 1) * sizeof(uint32_t));
+    padTo(header.meshletsOffset);
+    write(mesh.meshlets, static_cast<uint64_t>(header.meshletCount) * sizeof(Meshlet));
+    padTo(header.meshletSpheresOffset);
+    write(mesh.meshletSphereX, 4ull * meshletSphereLength(mesh.meshletCount) * sizeof(float));
+    padTo(header.meshletPositionsOffset);
+    write(mesh.meshletPositions, static_cast<uint64_t>(header.meshletPositionCount) * sizeof(float));
+    padTo(header.meshletIndicesOffset);
+    write(mesh.meshletIndices, static_cast<uint64_t>(header.meshletIndexCount) * sizeof(unsigned int));
+    CloseHandle(file);
+    if (!ok || !MoveFileExA(temporaryPath.c_str(), path, MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFileA(temporaryPath.c_str());
+        throw std::runtime_error(std::string("Can't write ") + path);
+    }
+}
+
+
+// Maps a mesh file and points the views of the mesh into it. The header has to describe sections that lie inside the
+// file at aligned offsets, and every index has to name a vertex, a cache file can be truncated or damaged on disk and
+// the vertex stage reads wherever the indices point. Throws if the file isn't a mesh file of this version, if it is
+// damaged, or if expectedSourceHash isn't 0 and the file was made from another source
+Mesh openMeshFile(const char* path, uint64_t expectedSourceHash = 0) {
+    Mesh mesh;
+    mesh.file.reset(new MappedFile(path));
+    const char* data = mesh.file->data;
+    size_t size = mesh.file->size;
+    MeshFileHeader header;
+    if (size < sizeof(header))
+    {
+        throw std::runtime_error(std::string(path) + " is not a mesh file");
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, meshFileMagic, sizeof(header.magic)) != 0)
+    {
+        throw std::runtime_error(std::string(path) + " is not a mesh file");
+    }
+    if (header.version != meshFileVersion || header.headerSize != sizeof(MeshFileHeader))
+    {
+        throw std::runtime_error(std::string(path) + " is a mesh file of another version");
+    }
+    if (expectedSourceHash != 0 && header.sourceHash != expectedSourceHash)
+    {
+        throw std::runtime_error(std::string(path) + " was made from another source");
+    }
+
+
+    uint64_t streamCount = 3 + ((header.flags & meshFileHasNormals) ? 3 : 0) + ((header.flags & meshFileHasTexCoords) ? 2 : 0);
+    auto section = [&](uint64_t offset, uint64_t bytes) {
+        return offset % meshFileAlignment == 0 && offset <= size && bytes <= size - offset;
+    };
+    if (header.fileSize != size || header.vertexCount > INT32_MAX || header.indexCount > INT32_MAX || header.indexCount % 3 != 0 ||
+        header.lodCount == 0 ||
+        header.streamLength != static_cast<uint32_t>(paddedStreamLength(static_cast<int>(header.vertexCount))) ||
+        !section(header.streamsOffset, streamCount * header.streamLength * sizeof(float)) ||
+        !section(header.indicesOffset, static_cast<uint64_t>(header.indexCount) * sizeof(unsigned int)) ||
+        !section(header.lodsOffset, static_cast<uint64_t>(header.lodCount) * sizeof(MeshLod)) ||
+        header.meshletCount > INT32_MAX - streamPadding ||
+        !section(header.meshletStartsOffset, (static_cast<uint64_t>(header.lodCount) + 1) * sizeof(uint32_t)) ||
+        !section(header.meshletsOffset, static_cast<uint64_t>(header.meshletCount) * sizeof(Meshlet)) ||
+        !section(header.meshletSpheresOffset, 4ull * meshletSphereLength(static_cast<int>(header.meshletCount)) * sizeof(float)) ||
+        !section(header.meshletPositionsOffset, static_cast<uint64_t>(header.meshletPositionCount) * sizeof(float)) ||
+        !section(header.meshletIndicesOffset, static_cast<uint64_t>(header.meshletIndexCount) * sizeof(unsigned int)))
+    {
+        throw std::runtime_error(std::string(path) + " is damaged");
+    }
+    const MeshLod* lods = reinterpret_cast<const MeshLod*>(data + header.lodsOffset);
+    const unsigned int* indices = reinterpret_cast<const unsigned int*>(data + header.indicesOffset);
+    for (uint32_t level = 0; level < header.lodCount; level++) {
+        if (lods[level].indexCount % 3 != 0 || lods[level].firstIndex > header.indexCount ||
+            lods[level].indexCount > header.indexCount - lods[level].firstIndex || lods[level].vertexCount > header.vertexCount)
+        {
+            throw std::runtime_error(std::string(path) + " is damaged");
+        }
+
+
+        // A level only transforms the vertices it uses, which come first
+        unsigned int largest = 0;
+        for (uint32_t i = lods[level].firstIndex; i < lods[level].firstIndex + lods[level].indexCount; i++) {
+            largest = std::max(largest, indices[i]);
+        }
+        if (lods[level].indexCount > 0 && largest >= lods[level].vertexCount)
+        {
+            throw std::runtime_error(std::string(path) + " is damaged");
+        }
+    }
+    unsigned int largest = 0;
+    for (uint32_t i = 0; i < header.indexCount; i++) {
+        largest = std::max(largest, indices[i]);
+    }
+    if (header.indexCount > 0 && largest >= header.vertexCount)
+    {
+        throw std::runtime_error(std::string(path) + " is damaged");
+    }
+
+
+    // The meshlets of the levels have to follow each other, and each one has to stay inside the position and index
+    // tables with no more vertices than the vertex stage makes room for and indices that only name those
+    const uint32_t* meshletStarts = reinterpret_cast<const uint32_t*>(data + header.meshletStartsOffset);
+    const Meshlet* meshlets = reinterpret_cast<const Meshlet*>(data + header.meshletsOffset);
+    const unsigned int* meshletIndices = reinterpret_cast<const unsigned int*>(data + header.meshletIndicesOffset);
+    bool meshletsValid = meshletStarts[0] == 0 && meshletStarts[header.lodCount] == header.meshletCount;
+    for (uint32_t level = 0; level < header.lodCount && meshletsValid; level++) {
+        meshletsValid = meshletStarts[level] <= meshletStarts[level + 1];
+    }
+    for (uint32_t i = 0; i < header.meshletCount && meshletsValid; i++) {
+        const Meshlet& meshlet = meshlets[i];
+        meshletsValid = meshlet.vertexCount <= static_cast<uint32_t>(maxMeshletVertices) && meshlet.indexCount % 3 == 0 &&
+            meshlet.indexCount <= static_cast<uint32_t>(3 * maxMeshletTriangles) && meshlet.positionOffset <= header.meshletPositionCount &&
+            meshlet.firstIndex <= header.meshletIndexCount && meshlet.indexCount <= header.meshletIndexCount - meshlet.firstIndex;
+        meshletsValid = meshletsValid &&
+            3u * paddedStreamLength(static_cast<int>(meshlet.vertexCount)) <= header.meshletPositionCount - meshlet.positionOffset;
+        for (uint32_t index = meshlet.firstIndex; index < meshlet.firstIndex + meshlet.indexCount && meshletsValid; index++) {
+            meshletsValid = meshletIndices[index] < meshlet.vertexCount;
+        }
+    }
+    if (!meshletsValid)
+    {
+        throw std::runtime_error(std::string(path) + " is damaged");
+    }
+
+
+    const float* stream = reinterpret_cast<const float*>(data + header.streamsOffset);
+    int count = static_cast<int>(header.vertexCount);
+    int length = static_cast<int>(header.streamLength);
+    mesh.positions = { count, stream, stream + length, stream + 2 * length };
+    stream += 3 * length;
+    if (header.flags & meshFileHasNormals)
+    {
+        mesh.normals = { count, stream, stream + length, stream + 2 * length };
+        stream += 3 * length;
+    }
+    if (header.flags & meshFileHasTexCoords)
+    {
+        mesh.texCoordU = stream;
+        mesh.texCoordV = stream + length;
+    }
+    mesh.indices = indices;
+    mesh.indexCount = static_cast<int>(header.indexCount);
+    mesh.lods = lods;
+    mesh.lodCount = static_cast<int>(header.lodCount);
+    mesh.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+    mesh.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+    const float* spheres = reinterpret_cast<const float*>(data + header.meshletSpheresOffset);
+    int sphereLength = meshletSphereLength(static_cast<int>(header.meshletCount));
+    mesh.meshlets = meshlets;
+    mesh.meshletCount = static_cast<int>(header.meshletCount);
+    mesh.lodMeshletStart = meshletStarts;
+    mesh.meshletSphereX = spheres;
+    mesh.meshletSphereY = spheres + sphereLength;
+    mesh.meshletSphereZ = spheres + 2 * sphereLength;
+    mesh.meshletSphereRadius = spheres + 3 * sphereLength;
+    mesh.meshletPositions = reinterpret_cast<const float*>(data + header.meshletPositionsOffset);
+    mesh.meshletIndices = meshletIndices;
+    return mesh;
+}
+
+
+// Converted models are kept in meshCacheDirectory under the hash of their source file, so a model is only parsed the
+// first time it is loaded and again after it changes, and a copy of a model under another name finds the same entry
+const char meshCacheDirectory[] = "meshcache";
+
+
+std::string meshCachePath(uint64_t sourceHash) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.mesh", static_cast<unsigned long long>(sourceHash));
+    return std::string(meshCacheDirectory) + "/" + name;
+}
+
+
+inline bool hasExtension(const char* path, const char* extension) {
+    size_t pathLength = std::strlen(path), extensionLength = std::strlen(extension);
+    return pathLength >= extensionLength && std::strcmp(path + pathLength - extensionLength, extension) == 0;
+}
+
+
+// Reads a model. A mesh file is mapped and used as it is. Anything else is taken to be an OBJ file and goes through
+// the cache: a cache entry made from the same bytes is mapped, otherwise the OBJ is parsed, its levels of detail and
+// meshlets are built and it is written to the cache. Either way the mesh comes back ready to draw
+Mesh readMesh(const char* path) {
+    if (hasExtension(path, ".mesh"))
+    {
+        return openMeshFile(path);
+    }
+
+
+    uint64_t sourceHash;
+    {
+        MappedFile source(path);
+        sourceHash = hashBytes(source.data, source.size) | 1; // Never 0, which means no source in a mesh file
+    }
+    std::string cachePath = meshCachePath(sourceHash);
+    if (GetFileAttributesA(cachePath.c_str()) != INVALID_FILE_ATTRIBUTES)
+    {
+        try
+        {
+            return openMeshFile(cachePath.c_str(), sourceHash);
+        }
+        catch (const std::exception&) {
+            // An entry of an older version or a damaged one is replaced below
+        }
+    }
+
+
+    Mesh mesh = loadObj(path);
+    buildMeshLods(mesh);
+    buildMeshlets(mesh);
+    try
+    {
+        CreateDirectoryA(meshCacheDirectory, nullptr);
+        writeMeshFile(mesh, sourceHash, cachePath.c_str());
+    }
+    catch (const std::exception&) {
+        // Drawing the model doesn't need the cache, it will just be parsed again next time
+    }
+    return mesh;
+}
+
+
+// Converter, run as cube --convert model.obj model.mesh
+int convertModel(const char* sourcePath, const char* meshPath) {
+    try
+    {
+        uint64_t sourceHash;
+        {
+            MappedFile source(sourcePath);
+            sourceHash = hashBytes(source.data, source.size) | 1;
+        }
+        Mesh mesh = loadObj(sourcePath);
+        buildMeshLods(mesh);
+        buildMeshlets(mesh);
+        writeMeshFile(mesh, sourceHash, meshPath);
+        std::cout << meshPath << ": " << mesh.positions.count << " vertices";
+        for (int level = 0; level < mesh.lodCount; level++) {
+            std::cout << (level == 0 ? ", " : " / ") << mesh.lods[level].indexCount / 3;
+        }
+        std::cout << " triangles\n";
+        return 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
+
+
+// Scene graph. Every node has a transform relative to its parent and can draw a mesh. Nodes are stored parents first,
+// so one pass in order works out every world transform. The world bounding spheres of the nodes with a mesh are kept
+// as one stream per component, padded like the vertex streams, so culling tests simdWidth of them at a time
+struct SceneNode
+{
+    int parent = -1;              // -1 for a root node
+    const Mesh* mesh = nullptr;   // Null for a node that only groups its children
+    glm::mat4 local = glm::mat4(1.0f);
+    glm::mat4 world = glm::mat4(1.0f);
+    bool occluder = false;        // Large and solid, like a wall, drawn first to hide the nodes behind it
+    bool hidden = false;          // Switched off, drawScene skips it
+};
+
+
+struct Scene
+{
+    std::vector<SceneNode> nodes;
+    std::vector<int> drawable; // Nodes with a mesh, in the order of the sphere streams
+    std::vector<float> sphereX, sphereY, sphereZ, sphereRadius;
+};
+
+
+// Adds a node and returns its index. The parent has to be added first
+int addSceneNode(Scene& scene, const Mesh* mesh, const glm::mat4& local, int parent = -1, bool occluder = false) {
+    if (parent >= static_cast<int>(scene.nodes.size()))
+    {
+        throw std::invalid_argument("Scene node parent must be added before its children");
+    }
+    int index = static_cast<int>(scene.nodes.size());
+    scene.nodes.push_back({ parent, mesh, local, local, occluder });
+    if (mesh)
+    {
+        scene.drawable.push_back(index);
+    }
+    return index;
+}
+
+
+// The sphere around the bounding box of a mesh, moved by a world transform and grown by the largest scale of it.
+// Returns the centre in xyz and the radius in w
+glm::vec4 worldBoundingSphere(const Mesh& mesh, const glm::mat4& world) {
+    glm::vec3 center = glm::vec3(world * glm::vec4(0.5f * (mesh.boundsMin + mesh.boundsMax), 1.0f));
+    float scale = std::max({ glm::length(glm::vec3(world[0])), glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2])) });
+    return glm::vec4(center, 0.5f * glm::length(mesh.boundsMax - mesh.boundsMin) * scale);
+}
+
+
+// Works out the world transforms and the world bounding spheres. The streams only grow when nodes are added, so this
+// allocates nothing from frame to frame
+void updateScene(Scene& scene) {
+    for (SceneNode& node : scene.nodes) {
+        node.world = (node.parent < 0) ? node.local : scene.nodes[node.parent].world * node.local;
+    }
+
+
+    int length = paddedStreamLength(static_cast<int>(scene.drawable.size()));
+    scene.sphereX.resize(length); scene.sphereY.resize(length); scene.sphereZ.resize(length); scene.sphereRadius.resize(length);
+    for (size_t i = 0; i < scene.drawable.size(); i++) {
+        const SceneNode& node = scene.nodes[scene.drawable[i]];
+        glm::vec4 sphere = worldBoundingSphere(*node.mesh, node.world);
+        scene.sphereX[i] = sphere.x;
+        scene.sphereY[i] = sphere.y;
+        scene.sphereZ[i] = sphere.z;
+        scene.sphereRadius[i] = sphere.w;
+    }
+}
+
+
+// Most vertices one draw of the mesh transforms at once, over all its levels of detail and its meshlets
+int largestDrawVertexCount(const Mesh& mesh) {
+    int largest = (mesh.meshletCount > 0) ? maxMeshletVertices : 0;
+    for (int level = 0; level < mesh.lodCount; level++) {
+        largest = std::max(largest, static_cast<int>(mesh.lods[level].vertexCount));
+    }
+    return largest;
+}
+
+
+// Sizes the output of the vertex stage for the largest draw of any mesh in the scene or drawn through drawInstanced,
+// so no frame has to grow it when the camera moves and another level is picked. Call it once the scene is built,
+// before drawing
+void reserveVertexStage(const Scene& scene, std::initializer_list<const Mesh*> instancedMeshes = {}) {
+    int largest = 0;
+    for (const SceneNode& node : scene.nodes) {
+        if (node.mesh)
+        {
+            largest = std::max(largest, largestDrawVertexCount(*node.mesh));
+        }
+    }
+    for (const Mesh* mesh : instancedMeshes) {
+        largest = std::max(largest, largestDrawVertexCount(*mesh));
+    }
+    reserveTransformedVertices(largest, transformedVertices);
+}
+
+
+// The six planes of the view volume in world space, normals pointing inwards and normalised so the plane equation
+// gives the signed distance. Order is left, right, bottom, top, near, far
+struct Frustum
+{
+    glm::vec4 planes[6];
+};
+
+
+// Takes the planes straight from the rows of the view projection matrix. A point is inside a plane when row 3 plus or
+// minus row 0, 1 or 2 is positive, which are the same -w < x, y, z < w tests as frustumOutcode
+Frustum extractFrustum(const glm::mat4& viewProjection) {
+    glm::vec4 rows[4];
+    for (int row = 0; row < 4; row++) {
+        rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+    }
+
+
+    Frustum frustum;
+    for (int axis = 0; axis < 3; axis++) {
+        frustum.planes[2 * axis] = rows[3] + rows[axis];
+        frustum.planes[2 * axis + 1] = rows[3] - rows[axis];
+    }
+    for (glm::vec4& plane : frustum.planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+    return frustum;
+}
+
+
+// Puts the index of every sphere that is not entirely behind one of the frustum planes into visible. The SIMD loop
+// tests simdWidth spheres against all six planes and turns the result into a bit mask, the lanes past the last sphere
+// are masked off. The streams have to be readable up to count rounded up to simdWidth
+void cullSpheres(const float* sphereX, const float* sphereY, const float* sphereZ, const float* sphereRadius, int count, const Frustum& frustum, ArenaVector<int>& visible) {
+    visible.reserve(visible.size() + count);
+
+
+    int i = 0;
+#if GLM_ARCH & (GLM_ARCH_AVX2_BIT | GLM_ARCH_SSE41_BIT)
+    simdFloat planes[6][4];
+    for (int plane = 0; plane < 6; plane++) {
+        for (int component = 0; component < 4; component++) {
+            planes[plane][component] = simdSet(frustum.planes[plane][component]);
+        }
+    }
+    const simdFloat zero = simdSet(0.0f);
+    for (; i < count; i += simdWidth) {
+        simdFloat x = simdLoad(&sphereX[i]), y = simdLoad(&sphereY[i]), z = simdLoad(&sphereZ[i]);
+        simdFloat negRadius = simdSub(zero, simdLoad(&sphereRadius[i]));
+        simdInt inside = simdSet(-1);
+        for (int plane = 0; plane < 6; plane++) {
+            simdFloat distance = simdAdd(simdAdd(simdAdd(simdMul(x, planes[plane][0]), simdMul(y, planes[plane][1])), simdMul(z, planes[plane][2])), planes[plane][3]);
+            inside = simdAnd(inside, simdGreater(distance, negRadius));
+        }
+
+
+        int mask = simdMoveMask(inside);
+        if (count - i < simdWidth)
+        {
+            mask &= (1 << (count - i)) - 1;
+        }
+        for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+            if (mask & 1)
             {
-                continue; // Skip this vertex if it is equal to the farPlane or in other words too far
+                visible.push_back(i + lane);
             }
         }
-        else
-        {
-            continue;
+    }
+#endif
+    for (; i < count; i++) {
+        glm::vec3 center(sphereX[i], sphereY[i], sphereZ[i]);
+        bool inside = true;
+        for (const glm::vec4& plane : frustum.planes) {
+            inside = inside && glm::dot(glm::vec3(plane), center) + plane.w > -sphereRadius[i];
         }
-
-        // Skip vertices that are outside the NDC range [-1, 1] for the z-axis (clipping range)
-        if (vertex.z < -1.0f || vertex.z > 1.0f)
+        if (inside)
         {
-            // Set to out-of-bounds values or skip the update
-            transformedVertices[i] = transformedVertices[i + 1] = transformedVertices[i + 2] = 2.0f; // Out-of-bounds
-            continue;
+            visible.push_back(i);
         }
-
-        // Assigns the respective vertice to its transformed value
-        transformedVertices[i]     = vertex.x;
-        transformedVertices[i + 1] = vertex.y;
-        transformedVertices[i + 2] = vertex.z;
     }
 }
 
 
-glm::vec3 calculateNormal(const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, const glm::vec3& cameraPos) {
-    glm::vec3 normal = glm::normalize(glm::cross(p2 - p1, p3 - p1)); // Calculates the normal of the triangle
-    glm::vec3 viewDir = glm::normalize(cameraPos - p1); // Finds the view direction of the camera
-    if (glm::dot(normal, viewDir) > 0)
-    {
-        normal = -normal; // Flip the normal if it's pointing towards the camera
+// Puts the nodes whose bounding sphere is inside the frustum into visible
+void cullScene(const Scene& scene, const Frustum& frustum, ArenaVector<int>& visible) {
+    size_t first = visible.size();
+    cullSpheres(scene.sphereX.data(), scene.sphereY.data(), scene.sphereZ.data(), scene.sphereRadius.data(), static_cast<int>(scene.drawable.size()), frustum, visible);
+    for (size_t i = first; i < visible.size(); i++) {
+        visible[i] = scene.drawable[visible[i]];
     }
-    return normal;
 }
 
 
-void fillTriangle(const std::tuple<int, int, float>& p1, const std::tuple<int, int, float>& p2, const std::tuple<int, int, float>& p3) {
-    int x1 = std::get<0>(p1), y1 = std::get<1>(p1); // Assigns x1 and y1 into p1
-    int x2 = std::get<0>(p2), y2 = std::get<1>(p2); // Assigns x2 and y2 into p2
-    int x3 = std::get<0>(p3), y3 = std::get<1>(p3); // Assigns x3 and y3 into p3
+// Levels of detail are picked so the error of the level is at most this many cells on screen
+const float lodErrorCells = 0.5f;
 
 
-    float z1 = std::get<2>(p1), z2 = std::get<2>(p2), z3 = std::get<2>(p3); // Assigns z1 into p1, z2 into p2 and z3 into p3
-
-
-    // Sort vertices by y-coordinate (y1 <= y2 <= y3)
-    if (y2 < y1)
+// Picks the coarsest level of detail of a mesh whose error, scaled to the size its world bounding sphere has on
+// screen, stays under lodErrorCells. The size in cells is measured against the grid of the output mode, so the finer
+// grids of the half block and braille modes get finer levels. The size is taken at the near side of the sphere, and a
+// sphere the camera is in gets the full mesh
+int selectLod(const Mesh& mesh, const glm::vec4& sphere, const glm::mat4& viewProjection) {
+    float meshRadius = 0.5f * glm::length(mesh.boundsMax - mesh.boundsMin);
+    glm::vec4 depthRow(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+    float distance = glm::dot(depthRow, glm::vec4(glm::vec3(sphere), 1.0f)) - sphere.w;
+    if (mesh.lodCount <= 1 || distance <= 0.0f || meshRadius <= 0.0f)
     {
-        std::swap(y1, y2); std::swap(x1, x2); std::swap(z1, z2);
+        return 0;
     }
 
 
-    if (y3 < y1)
-    {
-        std::swap(y1, y3); std::swap(x1, x3); std::swap(z1, z3);
-    }
-   
-    if (y3 < y2)
-    {
-        std::swap(y2, y3); std::swap(x2, x3); std::swap(z2, z3);
+    // The x and y rows of the projection scale view space to -1..1, which is the grid width or height in cells
+    float cellsX = 0.5f * gridWidth * glm::length(glm::vec3(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0]));
+    float cellsY = 0.5f * gridHeight * glm::length(glm::vec3(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1]));
+    float radiusCells = sphere.w * std::max(cellsX, cellsY) / distance;
+    float maxError = lodErrorCells / radiusCells * meshRadius;
+    int level = 0;
+    while (level + 1 < mesh.lodCount && mesh.lods[level + 1].error <= maxError) {
+        level++;
     }
+    return level;
+}
 
 
-    glm::vec3 point1 = glm::vec3(static_cast<float>(x1), static_cast<float>(y1), z1); // Establishes point1
-    glm::vec3 point2 = glm::vec3(static_cast<float>(x2), static_cast<float>(y2), z2); // Establishes point2
-    glm::vec3 point3 = glm::vec3(static_cast<float>(x3), static_cast<float>(y3), z3); // Establishes point3
-    glm::vec3 normal = calculateNormal(point1, point2, point3, cameraPos); // Calculates the normal for the triangle
+// Draws the meshlets of a level of detail that can be seen. The frustum planes are taken from the full transform, so
+// they are in model space like the meshlet spheres and the SIMD sphere test runs on the spheres as they are stored.
+// The vertex stage and triangle setup then only run on the meshlets that pass
+void drawMeshlets(const Mesh& mesh, int level, const glm::mat4& transform, ArenaVector<ScreenTriangle>& triangles) {
+    int first = mesh.lodMeshletStart[level];
+    int count = mesh.lodMeshletStart[level + 1] - first;
+    ArenaVector<int> visible;
+    cullSpheres(&mesh.meshletSphereX[first], &mesh.meshletSphereY[first], &mesh.meshletSphereZ[first], &mesh.meshletSphereRadius[first], count, extractFrustum(transform), visible);
+
+
+    // A closed surface only hides its back faces while all of it is seen from outside. That holds when its bounds
+    // are entirely past the near plane, which puts the camera outside them and clips none of the front faces away.
+    // The camera in model space is where the transform takes the point that ends up at w = 0 on the view axis
+    bool cones = true;
+    for (int corner = 0; corner < 8 && cones; corner++) {
+        glm::vec3 position((corner & 1) ? mesh.boundsMax.x : mesh.boundsMin.x, (corner & 2) ? mesh.boundsMax.y : mesh.boundsMin.y, (corner & 4) ? mesh.boundsMax.z : mesh.boundsMin.z);
+        glm::vec4 clip = transform * glm::vec4(position, 1.0f);
+        cones = clip.w > 0.0f && clip.z >= -clip.w;
+    }
+    glm::vec4 eye = glm::inverse(transform) * glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+    glm::vec3 camera = glm::vec3(eye) / eye.w;
 
 
-    // Interpolation helper
-    auto interpolate = [](int y, int y0, int y1, int x0, int x1, float z0, float z1) -> std::tuple<int, float> {
-        if (y1 == y0) return {x0, z0}; // Checks if y1 = y0 and if it is, we already know that x1 will be equal to x0 and z1 will be equal to z0
-        float t = static_cast<float>(y - y0) / (y1 - y0); // Finds the interpolation factor which changes y
-        int x = static_cast<int>(x0 + t * (x1 - x0)); // Uses t to interpolate x
-        float z = z0 + t * (z1 - z0); // Uses t to interpolate y
-        return {x, z};
-    };
+    prepareTransformedVertices(maxMeshletVertices, transformedVertices);
+    for (int index : visible) {
+        const Meshlet& meshlet = mesh.meshlets[first + index];
+        if (cones)
+        {
+            glm::vec3 toCenter = glm::vec3(mesh.meshletSphereX[first + index], mesh.meshletSphereY[first + index], mesh.meshletSphereZ[first + index]) - camera;
+            if (glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + mesh.meshletSphereRadius[first + index])
+            {
+                continue; // Every triangle faces away
+            }
+        }
 
 
-    float angleIntensity = glm::dot(normal, -lightDirection); // Calculates the lighting of the triangle by using the normal and comparing it to see how it is pointing at the light source
-    angleIntensity = std::pow(glm::clamp(angleIntensity, 0.0f, 1.0f), 1.5f);
+        int length = paddedStreamLength(static_cast<int>(meshlet.vertexCount));
+        const float* stream = &mesh.meshletPositions[meshlet.positionOffset];
+        transformVertices(transform, { static_cast<int>(meshlet.vertexCount), stream, stream + length, stream + 2 * length }, transformedVertices);
+        triangulateWithIndices(transformedVertices, &mesh.meshletIndices[meshlet.firstIndex], static_cast<int>(meshlet.indexCount), triangles);
+    }
+}
 
 
-    // Iterates over every y cooridinate from y1 to y2 which is the upper segment of the triangle
-    for (int y = y1; y <= y2; y++) {
-        auto [xa, za] = interpolate(y, y1, y3, x1, x3, z1, z3); // Finds the x and z cooridinates on the left side of the trinagle by using the interpolated value based on the y cooridinate
-        auto [xb, zb] = interpolate(y, y1, y2, x1, x2, z1, z2); // Finds the x and z cooridinates on the right side of the trinagle by using the interpolated value based on the y cooridinate
+// Transforms the vertices one level of detail uses and adds its triangles, through its meshlets if it has them
+void drawMeshLod(const Mesh& mesh, int level, const glm::mat4& transform, ArenaVector<ScreenTriangle>& triangles) {
+    if (mesh.lodMeshletStart != nullptr && mesh.lodMeshletStart[level] != mesh.lodMeshletStart[level + 1])
+    {
+        drawMeshlets(mesh, level, transform, triangles);
+        return;
+    }
 
 
-        if (xa > xb)
-        {
-            std::swap(xa, xb); std::swap(za, zb);
-        }
+    const MeshLod& lod = mesh.lods[level];
+    VertexStreams streams = mesh.positions;
+    streams.count = static_cast<int>(lod.vertexCount);
+    prepareTransformedVertices(streams.count, transformedVertices);
+    transformVertices(transform, streams, transformedVertices);
+    triangulateWithIndices(transformedVertices, mesh.indices + lod.firstIndex, static_cast<int>(lod.indexCount), triangles);
+}
 
 
-        // Iterates over x cooridinate between the x cooridinate on the left side to the x cooridinate on the right side
-        for (int x = xa; x <= xb; x++) {
-            float z = za + (zb - za) * (static_cast<float>(x - xa) / (xb - xa + 1e-6f)); // Calculates z by interpolating the difference between the left to the right side of the triangle based on the x cooridinates
-            if (x >= 0 && x < gridWidth && y >= 0 && y < gridHeight && z < zBuffer[y][x])  // Checks if the cooridnates are inbounds
-            {
-                zBuffer[y][x] = z; // Sets the new zBuffer
-               
-                glm::vec3 Pos = glm::vec3(x, y, z); // Setting the position as a vector so we can normalize it
-                glm::vec3 normPos = glm::normalize(Pos); // Normalize for lighting calculations only
+// Occlusion buffer. The occluders of the scene are drawn into it first at a much lower resolution than the grid, and
+// every other object is tested against it before its vertices are transformed. Each occluder is drawn at the corners
+// of the cells, and a cell only takes a depth when the occluder covers all four of its corners, the farthest of their
+// depths, so the buffer never claims more is hidden than is for the large solid shapes occluders are meant to be.
+// Testing corners against the whole occluder rather than single triangles keeps the cells along the diagonal of a
+// quad face, which neither of its triangles covers alone. Depths are NDC z, which grows away from the camera, and the
+// buffer starts out at FLT_MAX where nothing is hidden
+const int occlusionWidth = 64;
+const int occlusionHeight = 32;
+float occlusionDepth[occlusionHeight][occlusionWidth];
+float occluderCornerDepth[occlusionHeight + 1][occlusionWidth + 1]; // Nearest depth of the occluder being drawn
 
 
-                float dx = normPos.x - lightPosition.x; // Calculates the difference between the x position of the pixel and x position of the lightposition
-                float dy = normPos.y - lightPosition.y; // Calculates the difference between the y position of the pixel and y position of the lightposition
-                float dz = normPos.z - lightPosition.z; // Calculates the difference between the z position of the pixel and z position of the lightposition
+void clearOcclusion() {
+    std::fill(&occlusionDepth[0][0], &occlusionDepth[0][0] + occlusionWidth * occlusionHeight, FLT_MAX);
+}
 
 
-                float distance = sqrt(pow(dx, 2) + pow(dy, 2) + pow(dz, 2)); // Uses the pythagorous thereom to calculate the distance bewteen the lightposition and the pixel position
-                float maxDistance = 50.0f;
-                float clampedDistance = glm::clamp(distance, 1.0f, maxDistance); // Clamps the distance between 1 and 50
+// Draws the triangles of one occluder, as the vertex stage made them, into the occlusion buffer. Both windings are
+// drawn, a wall hides what is behind it whichever way it faces
+void rasterizeOccluders(const ScreenTriangle* triangles, size_t count) {
+    std::fill(&occluderCornerDepth[0][0], &occluderCornerDepth[0][0] + (occlusionWidth + 1) * (occlusionHeight + 1), FLT_MAX);
+    float scaleX = static_cast<float>(occlusionWidth) / static_cast<float>(gridWidth * subPixelScale);
+    float scaleY = static_cast<float>(occlusionHeight) / static_cast<float>(gridHeight * subPixelScale);
+    for (size_t i = 0; i < count; i++) {
+        glm::vec3 v[3];
+        for (int corner = 0; corner < 3; corner++) {
+            const ScreenVertex& vertex = triangles[i].v[corner];
+            v[corner] = glm::vec3(vertex.x * scaleX, vertex.y * scaleY, vertex.z);
+        }
+        float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[1].y - v[0].y) * (v[2].x - v[0].x);
+        if (area == 0.0f)
+        {
+            continue;
+        }
+        if (area < 0.0f)
+        {
+            std::swap(v[1], v[2]);
+            area = -area;
+        }
 
 
-                // Smoother falloff for distance attenuation (inverse-square law approximation)
-                float distanceIntensity = 1.0f / (clampedDistance * clampedDistance);
+        // Depth plane of the triangle, z = depthX * x + depthY * y + depth0
+        float depthX = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+        float depthY = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+        float depth0 = v[0].z - depthX * v[0].x - depthY * v[0].y;
+
+
+        // Every cell corner inside the triangle, edges included so corners on an edge two triangles share count
+        int minX = std::max(0, static_cast<int>(std::ceil(std::min({ v[0].x, v[1].x, v[2].x }))));
+        int maxX = std::min(occlusionWidth, static_cast<int>(std::floor(std::max({ v[0].x, v[1].x, v[2].x }))));
+        int minY = std::max(0, static_cast<int>(std::ceil(std::min({ v[0].y, v[1].y, v[2].y }))));
+        int maxY = std::min(occlusionHeight, static_cast<int>(std::floor(std::max({ v[0].y, v[1].y, v[2].y }))));
+        for (int y = minY; y <= maxY; y++) {
+            for (int x = minX; x <= maxX; x++) {
+                bool inside = true;
+                for (int edge = 0; edge < 3 && inside; edge++) {
+                    const glm::vec3& a = v[edge], & b = v[(edge + 1) % 3];
+                    inside = (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x) >= 0.0f;
+                }
+                if (inside)
+                {
+                    occluderCornerDepth[y][x] = std::min(occluderCornerDepth[y][x], depth0 + depthX * x + depthY * y);
+                }
+            }
+        }
+    }
 
 
-                // Combine the two factors
-                float intensity = angleIntensity * distanceIntensity;
-               
-               
-                // Choose character based on intensity
-                char shadingChar = (intensity > 0.13f ) ? '@' :
-                                   (intensity > 0.125f && intensity < 0.13f) ? '#' :
-                                   (intensity > 0.5f && intensity < 0.125f) ? '*' :
-                                   (intensity <= 0.5f) ? '.' : '.';
-                grid[y][x] = shadingChar; // Sets the pixels in that position to the assigned colour
-            }
+    for (int y = 0; y < occlusionHeight; y++) {
+        for (int x = 0; x < occlusionWidth; x++) {
+            float farthest = std::max({ occluderCornerDepth[y][x], occluderCornerDepth[y][x + 1], occluderCornerDepth[y + 1][x], occluderCornerDepth[y + 1][x + 1] });
+            occlusionDepth[y][x] = std::min(occlusionDepth[y][x], farthest);
         }
     }
+}
 
 
-    // Lower part of triangle
-    for (int y = y2; y <= y3; y++) {
-        auto [xa, za] = interpolate(y, y1, y3, x1, x3, z1, z3); // Finds the x and z cooridinates on the left side of the trinagle by using the interpolated value based on the y cooridinate
-        auto [xb, zb] = interpolate(y, y2, y3, x2, x3, z2, z3); // Finds the x and z cooridinates on the right side of the trinagle by using the interpolated value based on the y cooridinate
-       
-        if (xa > xb)
+// True when the bounding box of a mesh, put on screen by transform, lies behind the occluders everywhere it covers.
+// The box corners give its screen rectangle and its nearest depth. A box that reaches the near plane is never hidden
+bool occluded(const Mesh& mesh, const glm::mat4& transform) {
+    glm::vec2 minCorner(FLT_MAX), maxCorner(-FLT_MAX);
+    float nearest = FLT_MAX;
+    for (int corner = 0; corner < 8; corner++) {
+        glm::vec3 position((corner & 1) ? mesh.boundsMax.x : mesh.boundsMin.x, (corner & 2) ? mesh.boundsMax.y : mesh.boundsMin.y, (corner & 4) ? mesh.boundsMax.z : mesh.boundsMin.z);
+        glm::vec4 clip = transform * glm::vec4(position, 1.0f);
+        if (clip.w <= 0.0f || clip.z < -clip.w)
         {
-            std::swap(xa, xb); std::swap(za, zb);
+            return false;
         }
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        minCorner = glm::min(minCorner, glm::vec2(ndc));
+        maxCorner = glm::max(maxCorner, glm::vec2(ndc));
+        nearest = std::min(nearest, ndc.z);
+    }
 
 
-        // Iterates over x cooridinate between the x cooridinate on the left side to the x cooridinate on the right side
-        for (int x = xa; x <= xb; x++) {
-            float z = za + (zb - za) * (static_cast<float>(x - xa) / (xb - xa + 1e-6f));
-            if (x >= 0 && x < gridWidth && y >= 0 && y < gridHeight && z < zBuffer[y][x])
+    int minX = std::max(0, static_cast<int>(std::floor((minCorner.x + 1.0f) * 0.5f * occlusionWidth)));
+    int maxX = std::min(occlusionWidth - 1, static_cast<int>(std::floor((maxCorner.x + 1.0f) * 0.5f * occlusionWidth)));
+    int minY = std::max(0, static_cast<int>(std::floor((minCorner.y + 1.0f) * 0.5f * occlusionHeight)));
+    int maxY = std::min(occlusionHeight - 1, static_cast<int>(std::floor((maxCorner.y + 1.0f) * 0.5f * occlusionHeight)));
+    if (minX > maxX || minY > maxY)
+    {
+        return false; // Off screen, which frustum culling deals with
+    }
+    for (int y = minY; y <= maxY; y++) {
+        for (int x = minX; x <= maxX; x++) {
+            if (occlusionDepth[y][x] >= nearest)
             {
-                zBuffer[y][x] = z;
+                return false;
+            }
+        }
+    }
+    return true;
+}
 
 
-                glm::vec3 Pos = glm::vec3(x, y, z); // Setting the position as a vector so we can normalize it
-                glm::vec3 normPos = glm::normalize(Pos); // Normalize for lighting calculations only
+// Culls the scene against the camera and adds the triangles of every node that is left to triangles, each at the
+// level of detail its size on screen needs. The occluders are drawn first and their triangles go into the occlusion
+// buffer as well, then the other nodes are only drawn if their bounds aren't hidden behind them
+void drawScene(const Scene& scene, const glm::mat4& viewProjection, ArenaVector<ScreenTriangle>& triangles) {
+    ArenaVector<int> visible;
+    cullScene(scene, extractFrustum(viewProjection), visible);
+    clearOcclusion();
+    bool anyOccluders = false;
+    for (int pass = 0; pass < 2; pass++) {
+        bool occluders = pass == 0;
+        for (int node : visible) {
+            const SceneNode& sceneNode = scene.nodes[node];
+            const Mesh& mesh = *sceneNode.mesh;
+            glm::mat4 transform = viewProjection * sceneNode.world;
+            if (sceneNode.hidden || sceneNode.occluder != occluders || (!occluders && anyOccluders && occluded(mesh, transform)))
+            {
+                continue;
+            }
 
 
-                float dx = normPos.x - lightPosition.x; // Calculates the difference between the x position of the pixel and x position of the lightposition
-                float dy = normPos.y - lightPosition.y; // Calculates the difference between the y position of the pixel and y position of the lightposition
-                float dz = normPos.z - lightPosition.z; // Calculates the difference between the z position of the pixel and z position of the lightposition
+            size_t first = triangles.size();
+            drawMeshLod(mesh, selectLod(mesh, worldBoundingSphere(mesh, sceneNode.world), viewProjection), transform, triangles);
+            if (occluders)
+            {
+                rasterizeOccluders(triangles.data() + first, triangles.size() - first);
+                anyOccluders = true;
+            }
+        }
+    }
+}
 
 
-                float distance = sqrt(pow(dx, 2) + pow(dy, 2) + pow(dz, 2)); // Uses the pythagorous thereom to calculate the distance bewteen the lightposition and the pixel position
-                float maxDistance = 50.0f;
-                float clampedDistance = glm::clamp(distance, 1.0f, maxDistance); // Clamps the distance between 1 and 50
+// Draws a mesh once for every model matrix in instances and adds the triangles to triangles. The bounding spheres of
+// all instances are culled in one batch, the levels of detail of the ones left are picked, and the triangle array is
+// sized once for all of those levels, so each instance only costs its pass through the SIMD vertex loop and triangle
+// setup. The mesh has to be one reserveVertexStage was given
+void drawInstanced(const Mesh& mesh, const glm::mat4* instances, int instanceCount, const glm::mat4& viewProjection, ArenaVector<ScreenTriangle>& triangles) {
+    int length = (instanceCount + simdWidth - 1) / simdWidth * simdWidth;
+    float* spheres = static_cast<float*>(frameArena.allocate(4 * length * sizeof(float), alignof(float)));
+    float* sphereX = spheres, * sphereY = spheres + length, * sphereZ = spheres + 2 * length, * sphereRadius = spheres + 3 * length;
+    for (int i = 0; i < length; i++) {
+        glm::vec4 sphere = (i < instanceCount) ? worldBoundingSphere(mesh, instances[i]) : glm::vec4(0.0f);
+        sphereX[i] = sphere.x;
+        sphereY[i] = sphere.y;
+        sphereZ[i] = sphere.z;
+        sphereRadius[i] = sphere.w;
+    }
+    ArenaVector<int> visible;
+    cullSpheres(sphereX, sphereY, sphereZ, sphereRadius, instanceCount, extractFrustum(viewProjection), visible);
+
+
+    ArenaVector<int> levels;
+    levels.reserve(visible.size());
+    size_t triangleCount = 0;
+    for (int instance : visible) {
+        glm::vec4 sphere(sphereX[instance], sphereY[instance], sphereZ[instance], sphereRadius[instance]);
+        int level = selectLod(mesh, sphere, viewProjection);
+        levels.push_back(level);
+        triangleCount += mesh.lods[level].indexCount / 3;
+    }
+    triangles.reserve(triangles.size() + triangleCount);
+    for (size_t i = 0; i < visible.size(); i++) {
+        drawMeshLod(mesh, levels[i], viewProjection * instances[visible[i]], triangles);
+    }
+}
 
 
-                // Smoother falloff for distance attenuation (inverse-square law approximation)
-                float distanceIntensity = 1.0f / (clampedDistance * clampedDistance);
+bool debounceKey(int keyCode) {
+    return (GetAsyncKeyState(keyCode) & 0x8000) != 0;
+}
 
 
-                // Combine the two factors
-                float intensity = angleIntensity * distanceIntensity;
-               
-               
-                // Choose character based on intensity
-                char shadingChar = (intensity > 0.13f ) ? '@' :
-                                   (intensity > 0.125f && intensity < 0.13f) ? '#' :
-                                   (intensity > 0.5f && intensity < 0.125f) ? '*' :
-                                   (intensity <= 0.5f) ? '.' : '.';
-                grid[y][x] = shadingChar; // Sets the pixels in that position to the assigned colour
-            }
-        }
-    }
+// Only true on the frame a key goes down, so holding the key does not repeat the action every frame
+bool keyPressed(int keyCode) {
+    static bool wasDown[256] = {};
+    bool down = debounceKey(keyCode);
+    bool pressed = down && !wasDown[keyCode];
+    wasDown[keyCode] = down;
+    return pressed;
 }
 
 
+void calculateCamRot()
+{
+    // Update camera rotation matrix based on current rotation angles
+    cameraRotation = glm::rotate(glm::mat4(1.0f), cameraRotationY, glm::vec3(0.0f, 1.0f, 0.0f)); // Y-axis rotation
+    cameraRotation = glm::rotate(cameraRotation, cameraRotationX, glm::vec3(1.0f, 0.0f, 0.0f)); // X-axis rotation
 
 
-void drawLine(const std::tuple<int, int, float>& p1, const std::tuple<int, int, float>& p2) {
-    int x1 = std::get<0>(p1), y1 = std::get<1>(p1); // Assigns x1 and y1 to p1
-    int x2 = std::get<0>(p2), y2 = std::get<1>(p2); // Assigns x2 and y2 to p2
-    float z1 = std::get<2>(p1), z2 = std::get<2>(p2); // Assigns z1 to p1 and z2 to p2
+    // Update the forward and right directions based on the new rotation
+    forward = glm::normalize(glm::vec3(cameraRotation * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f))); // Forward direction
+    right = glm::normalize(glm::cross(forward, cameraUp)); // Right direction
+}
 
 
-    int dx = x2 - x1; // Finds the difference between the first x cooridiante and the second x coordidinate
-    int dy = y2 - y1; // Finds the difference between the first y cooridiante and the second y coordidinate
-   
-    double hypotenuse = sqrt(pow(dx, 2) + pow(dy, 2)); // Finds the hypotenuse of the legs which gives us the distance between them
+// Hands frames from one thread to another without locks. The writer fills its buffer and publishes it into the middle
+// slot, taking back whatever was there, and the reader takes the middle slot when a fresh frame has been published. A
+// writer that is ahead of the reader replaces the frame the reader has not taken yet. The handoff itself never blocks,
+// the mutex is only there so a side with nothing to do can sleep on the condition variable until the other side
+// publishes or takes a frame, instead of spinning
+template<typename T>
+class TripleBuffer
+{
+public:
+    T& writeBuffer() { return buffers[writeIndex]; }
+    const T& readBuffer() const { return buffers[readIndex]; }
 
 
-    int steps = static_cast<int>(hypotenuse);
+    // Any of the three buffers, only for setting them up before the threads start
+    T& buffer(int index) { return buffers[index]; }
 
 
-    for (int i = 0; i <= steps; i++) {
-        int x = static_cast<int>(x1 + (dx * i) / steps); // Calculates the x cooridiante
-        int y = static_cast<int>(y1 + (dy * i) / steps); // Calculates the y cooridiante
-        float z = z1 + (z2 - z1) * (static_cast<float>(i) / steps) + 1e-6f;
- // Calculates the z cooridinate
+    void publish() {
+        writeIndex = middle.exchange(writeIndex | freshBit, std::memory_order_acq_rel) & indexMask;
+        wake();
+    }
 
 
-        if (x >= 0 && x < gridWidth && y >= 0 && y < gridHeight) // Checks if x and y is on the grid
+    // Takes the last published frame as the read buffer, false if nothing has been published since the last one taken
+    bool acquire() {
+        if (!pending())
         {
-            // Depth test
-            if (z < zBuffer[y][x])
-            {
-                zBuffer[y][x] = z;  // Update the Z-buffer
-                grid[y][x] = '*';   // Draw pixel if closer than what's in the Z-buffer
-            }
-            if (z == zBuffer[y][x])
-            {
-                continue;
-            }
+            return false;
         }
+        readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+        wake();
+        return true;
     }
-}
 
 
-void render(const std::vector<std::tuple<int, int, float>>& triangles) {
-    // Resize the back buffer to the grid dimensions and clear it
-    backBuffer.clear();
-    backBuffer.reserve(gridHeight * (gridWidth + 1)); // Preallocate space for performance
+    // True while a published frame is waiting for the reader
+    bool pending() const {
+        return (middle.load(std::memory_order_acquire) & freshBit) != 0;
+    }
 
 
-    // Iterates over every position in the grid and assigns default values
-    for (int y = 0; y < gridHeight; y++) {
-        for (int x = 0; x < gridWidth; x++) {
-            grid[y][x] = ' ';
-            zBuffer[y][x] = 1.0f; // Use a large value
+    // Sleeps until a frame is waiting for the reader, or running goes false
+    void waitPublished(const std::atomic<bool>& running) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return pending() || !running; });
+    }
+
+
+    // Sleeps until the reader has taken the last frame, or running goes false
+    void waitTaken(const std::atomic<bool>& running) {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return !pending() || !running; });
+    }
+
+
+    // Wakes both sides to look again. Taking the mutex first means a side that has just found nothing to do is either
+    // already asleep and gets the notification, or hasn't looked yet and will see the change
+    void wake() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
         }
+        changed.notify_all();
     }
 
+private:
+    static const int indexMask = 3;
+    static const int freshBit = 4;
 
-    for (size_t i = 0; i < triangles.size(); i += 3) {
-        glm::vec3 v0(transformedVertices[i * 3], transformedVertices[i * 3 + 1], transformedVertices[i * 3 + 2]);
-        glm::vec3 v1(transformedVertices[(i + 1) * 3], transformedVertices[(i + 1) * 3 + 1], transformedVertices[(i + 1) * 3 + 2]);
-        glm::vec3 v2(transformedVertices[(i + 2) * 3], transformedVertices[(i + 2) * 3 + 1], transformedVertices[(i + 2) * 3 + 2]);
+    T buffers[3];
+    int writeIndex = 0;              // Only touched by the writer
+    int readIndex = 1;               // Only touched by the reader
+    std::atomic<int> middle{ 2 };    // Index of the buffer between them, with freshBit set when it holds a new frame
+    std::mutex mutex;
+    std::condition_variable changed; // Notified on every publish and acquire
+};
 
 
-        fillTriangle(triangles[i], triangles[i + 1], triangles[i + 2]);
+// The switches the keys flip. The simulation reads the keys, and the raster thread applies them between its frames
+struct RenderSettings
+{
+    Rasterizer rasterizer;
+    DepthFormat depthFormat;
+    bool visibilityBuffer;
+    bool coverageSampling;
+    OutputMode outputMode;
+};
 
-    }
 
+// The G key draws a grid of copies of the model behind it, through drawInstanced
+const int instanceGridSize = 8;
+const float instanceSpacing = 1.5f;
 
 
-    // Build the back buffer from the grid
-    for (int y = 0; y < gridHeight; y++) {
-        for (int x = 0; x < gridWidth; x++) {
-            backBuffer += grid[y][x];
-        }
-        backBuffer += '\n';
-    }
+// Everything the raster thread needs from the simulation to draw a frame
+struct SimulationFrame
+{
+    glm::mat4 viewProjection;
+    std::vector<glm::mat4> localTransforms;     // Local transform of every scene node, filled in before the pipeline starts
+    std::vector<char> hiddenNodes;              // Whether every scene node is switched off, sized the same way
+    const Mesh* instanceMesh;
+    std::vector<glm::mat4> instances;           // Model matrices of the copies, sized before the pipeline starts
+    int instanceCount;                          // 0 when the grid is off
+    glm::vec3 cameraPos;
+    RenderSettings settings;
+    float deltaTime;
+};
 
 
-    // Swap buffers
-    std::swap(frontBuffer, backBuffer);
+// The frame pipeline. While the main thread simulates frame N+2, the raster thread draws frame N+1 and the output
+// thread writes frame N to the terminal, so a slow terminal (over SSH it can take longer than drawing) no longer holds
+// up the renderer. Frames the terminal was too slow to take are dropped for newer ones
+TripleBuffer<SimulationFrame> simulationFrames;
+TripleBuffer<TerminalFrame> outputFrames;
+std::atomic<bool> pipelineRunning{ true };
 
 
-    // Display the front buffer
-    std::cout << frontBuffer;
+// Stops every stage, waking the ones asleep on a frame buffer so they see it
+void stopPipeline() {
+    pipelineRunning = false;
+    simulationFrames.wake();
+    outputFrames.wake();
 }
 
 
-std::vector<std::tuple<int, int, float>> triangulateWithIndices(const float* vertices, int numVertices, const unsigned int* indices, int numIndices) {
-    std::vector<std::tuple<int, int, float>> triangles; // Creates a vector with the cooridinates of each vertex
-
+// Runs a stage of the pipeline on its own thread. An exception stops the whole pipeline, so it ends the program the
+// way one thrown on the main thread does
+template<typename Stage>
+void runPipelineStage(Stage stage) {
+    try
+    {
+        stage();
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        stopPipeline();
+    }
+}
 
-    // Iterates over every 3 indices
-    for (int i = 0; i < numIndices; i += 3) {
-        int index1 = indices[i] * 3; // Makes index equal to the x cooridinate of the respective point which is i
-        int index2 = indices[i + 1] * 3; // Makes index equal to the y cooridinate of the respective point which is i
-        int index3 = indices[i + 2] * 3; // Makes index equal to the z cooridinate of the respective point which is i
 
+// The raster and output threads. Going out of scope stops the pipeline and joins them, so an exception thrown by the
+// simulation unwinds through here instead of destroying threads that are still running, which would end the program
+struct PipelineThreads
+{
+    std::thread raster;
+    std::thread output;
 
-        if (index1 < 0 || index1 >= numVertices * 3 || index2 < 0 || index2 >= numVertices * 3 || index3 < 0 || index3 >= numVertices * 3)
-        {
-            continue; // Skip invalid indices.
+    ~PipelineThreads() {
+        stopPipeline();
+        for (std::thread* thread : { &raster, &output }) {
+            if (thread->joinable())
+            {
+                thread->join();
+            }
         }
+    }
+};
 
 
-        int x1 = mapToGrid(vertices[index1], gridWidth); // index1 in this example represents the x cooridinate of the first point of the triangle. The vertices array picks the correct float off the list by the number calculated for index1
-        int y1 = mapToGrid(vertices[index1 + 1], gridHeight); // index1 in this example represents the y cooridinate of the first point of the triangle
-        float z1 = vertices[index1 + 2]; // index1 in this example represents the z cooridinate of the first point of the triangle
+// Draws every frame the simulation publishes into the write buffer of the output frames
+void rasterStage(Scene& scene) {
+    while (pipelineRunning) {
+        if (!simulationFrames.acquire())
+        {
+            simulationFrames.waitPublished(pipelineRunning);
+            continue;
+        }
+        const SimulationFrame& frame = simulationFrames.readBuffer();
+        beginFrame();
 
 
-        int x2 = mapToGrid(vertices[index2], gridWidth); // index2 in this example represents the x cooridinate of the second point of the triangle. The vertices array picks the correct float off the list by the number calculated for index2
-        int y2 = mapToGrid(vertices[index2 + 1], gridHeight); // index2 in this example represents the y cooridinate of the second point of the triangle
-        float z2 = vertices[index2 + 2]; // index2 in this example represents the z cooridinate of the second point of the triangle
+        rasterizer = frame.settings.rasterizer;
+        depthFormat = frame.settings.depthFormat;
+        visibilityBuffer = frame.settings.visibilityBuffer;
+        coverageSampling = frame.settings.coverageSampling;
+        if (frame.settings.outputMode != outputMode)
+        {
+            setOutputMode(frame.settings.outputMode);
+        }
+        renderCameraPos = frame.cameraPos;
 
 
-        int x3 = mapToGrid(vertices[index3], gridWidth); // index3 in this example represents the x cooridinate of the third point of the triangle. The vertices array picks the correct float off the list by the number calculated for index3
-        int y3 = mapToGrid(vertices[index3 + 1], gridHeight); // index3 in this example represents the y cooridinate of the third point of the triangle
-        float z3 = vertices[index3 + 2]; // index3 in this example represents the z cooridinate of the third point of the triangle
+        for (size_t i = 0; i < scene.nodes.size(); i++) {
+            scene.nodes[i].local = frame.localTransforms[i];
+            scene.nodes[i].hidden = frame.hiddenNodes[i] != 0;
+        }
+        updateScene(scene);
 
 
-        // Skip vertices that are off the screen (outside grid bounds)
-        if ((x1 < 0 || x1 >= gridWidth || y1 < 0 || y1 >= gridHeight) ||
-            (x2 < 0 || x2 >= gridWidth || y2 < 0 || y2 >= gridHeight) ||
-            (x3 < 0 || x3 >= gridWidth || y3 < 0 || y3 >= gridHeight))
+        // Cull, transform and draw the updated scene
+        ArenaVector<ScreenTriangle> triangles;
+        drawScene(scene, frame.viewProjection, triangles);
+        if (frame.instanceCount > 0)
         {
-            continue;
+            drawInstanced(*frame.instanceMesh, frame.instances.data(), frame.instanceCount, frame.viewProjection, triangles);
         }
+        TerminalFrame& output = outputFrames.writeBuffer();
+        render(triangles, output);
+        output.frameTime = frame.deltaTime;
+        outputFrames.publish();
+        endFrame();
+    }
+}
 
 
-        triangles.emplace_back(x1, y1, z1); // Places the cooridinates for the first point in the triangle into triangles
-        triangles.emplace_back(x2, y2, z2); // Places the cooridinates for the second point in the triangle into triangles
-        triangles.emplace_back(x3, y3, z3); // Places the cooridinates for the third point in the triangle into triangles
+// Hands the text straight to the console, bypassing the C++ streams so a frame goes out in one write instead of being
+// split up by their buffering
+void writeTerminal(HANDLE console, const char* text, size_t size) {
+    while (size > 0) {
+        DWORD chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+        DWORD done = 0;
+        if (!WriteFile(console, text, chunk, &done, nullptr) || done == 0)
+        {
+            throw std::runtime_error("Can't write to the terminal");
+        }
+        text += done;
+        size -= done;
     }
+}
 
 
-    return triangles;
+// Writes the newest drawn frame to the terminal, blocking on the terminal instead of the raster thread. Only the
+// characters that differ from what the terminal already shows are sent
+void outputStage(HANDLE console) {
+    while (pipelineRunning) {
+        if (!outputFrames.acquire())
+        {
+            outputFrames.waitPublished(pipelineRunning);
+            continue;
+        }
+        encodeFrame(outputFrames.readBuffer(), terminal, terminalText);
+        writeTerminal(console, terminalText.data(), terminalText.size());
+    }
 }
 
 
-bool debounceKey(int keyCode) {
-    return (GetAsyncKeyState(keyCode) & 0x8000) != 0;
-}
+int main(int argc, char** argv) {
+    if (argc == 4 && std::strcmp(argv[1], "--convert") == 0)
+    {
+        return convertModel(argv[2], argv[3]);
+    }
 
 
-void calculateCamRot()
-{
-    // Update camera rotation matrix based on current rotation angles
-    cameraRotation = glm::rotate(glm::mat4(1.0f), cameraRotationY, glm::vec3(0.0f, 1.0f, 0.0f)); // Y-axis rotation
-    cameraRotation = glm::rotate(cameraRotation, cameraRotationX, glm::vec3(1.0f, 0.0f, 0.0f)); // X-axis rotation
+    auto previousTime = std::chrono::steady_clock::now();
 
 
-    // Update the forward and right directions based on the new rotation
-    forward = glm::normalize(glm::vec3(cameraRotation * glm::vec4(0.0f, 0.0f, -1.0f, 0.0f))); // Forward direction
-    right = glm::normalize(glm::cross(forward, cameraUp)); // Right direction
-}
+    // The half block and braille output modes write UTF-8 and colour escape sequences
+    SetConsoleOutputCP(CP_UTF8);
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD consoleMode = 0;
+    GetConsoleMode(console, &consoleMode);
+    SetConsoleMode(console, consoleMode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
 
 
-int main() {
-    auto previousTime = std::chrono::steady_clock::now();
+    startTileWorkers(); // Up front, so switching to the tiled rasterizer doesn't start threads in the middle of a frame
 
 
     try
     {
-        while (true) {
-            clearScreen();
+        // A model given on the command line takes the place of the cube, scaled and centred to fill the same space
+        Mesh mesh = (argc > 1) ? readMesh(argv[1]) : makeCubeMesh();
+        glm::vec3 extent = mesh.boundsMax - mesh.boundsMin;
+        float largestExtent = std::max({ extent.x, extent.y, extent.z });
+        glm::mat4 fitModel = glm::scale(glm::mat4(1.0f), glm::vec3(largestExtent > 0.0f ? 1.0f / largestExtent : 1.0f)) *
+                             glm::translate(glm::mat4(1.0f), -0.5f * (mesh.boundsMin + mesh.boundsMax));
+        Scene scene;
+        int modelNode = addSceneNode(scene, &mesh, glm::mat4(1.0f));
+
+
+        // A wall between the starting camera and the model, switched on with B. It is an occluder, so while it stands
+        // in front of the model the model is culled without being drawn
+        Mesh wallMesh = makeCubeMesh();
+        glm::mat4 wallTransform = glm::translate(glm::mat4(1.0f), 0.5f * (cameraPos + cubePosition)) *
+                                  glm::rotate(glm::mat4(1.0f), glm::radians(45.0f), glm::vec3(0.0f, 1.0f, 0.0f)) *
+                                  glm::scale(glm::mat4(1.0f), glm::vec3(3.0f, 2.0f, 0.1f));
+        int wallNode = addSceneNode(scene, &wallMesh, wallTransform, -1, true);
+        bool wallShown = false;
+        reserveVertexStage(scene, { &mesh }); // The model is also the mesh of the grid of copies
+
+
+        // Size every buffer of the pipeline up front, so no stage allocates once frames are flowing. Only the model node
+        // moves, so the simulation frames start with every other node where it is
+        for (int i = 0; i < 3; i++) {
+            for (const SceneNode& node : scene.nodes) {
+                simulationFrames.buffer(i).localTransforms.push_back(node.local);
+                simulationFrames.buffer(i).hiddenNodes.push_back(0);
+            }
+            simulationFrames.buffer(i).instances.resize(instanceGridSize * instanceGridSize);
+        }
+        terminalText.reserve(maxEncodedFrameSize());
+        RenderSettings settings = { rasterizer, depthFormat, visibilityBuffer, coverageSampling, outputMode };
+        bool instanceGrid = false;
+
+
+        PipelineThreads threads;
+        threads.raster = std::thread([&] { runPipelineStage([&] { rasterStage(scene); }); });
+        threads.output = std::thread([&] { runPipelineStage([&] { outputStage(console); }); });
+
+
+        // The main thread is the simulation stage, a frame ahead of the raster thread
+        while (pipelineRunning) {
+            // Wait until the raster thread has taken the last frame, so the simulation steps once per drawn frame
+            if (simulationFrames.pending())
+            {
+                simulationFrames.waitTaken(pipelineRunning);
+                continue;
+            }
 
 
             // Flag to track if the rotation matrix needs updating
@@ -560,6 +5247,68 @@ int main() {
             }
 
 
+            // Switch between the rasterizers
+            if (debounceKey('1'))
+            {
+                settings.rasterizer = Rasterizer::Scanline;
+            }
+            if (debounceKey('2'))
+            {
+                settings.rasterizer = Rasterizer::EdgeFunction;
+            }
+            if (debounceKey('3'))
+            {
+                settings.rasterizer = Rasterizer::Tiled;
+            }
+
+
+            // Cycle through the depth buffer formats
+            if (keyPressed('Z'))
+            {
+                DepthFormat format = settings.depthFormat;
+                settings.depthFormat = (format == DepthFormat::Float32) ? DepthFormat::Unorm24 :
+                                       (format == DepthFormat::Unorm24) ? DepthFormat::Unorm16 :
+                                       (format == DepthFormat::Unorm16) ? DepthFormat::Packed24 : DepthFormat::Float32;
+            }
+
+
+            // Switch between shading while rasterizing and shading from the visibility buffer
+            if (keyPressed('V'))
+            {
+                settings.visibilityBuffer = !settings.visibilityBuffer;
+            }
+
+
+            // Switch sub-cell coverage sampling on and off
+            if (keyPressed('C'))
+            {
+                settings.coverageSampling = !settings.coverageSampling;
+            }
+
+
+            // Cycle through the output modes
+            if (keyPressed('O'))
+            {
+                OutputMode mode = settings.outputMode;
+                settings.outputMode = (mode == OutputMode::Ascii) ? OutputMode::HalfBlock :
+                                      (mode == OutputMode::HalfBlock) ? OutputMode::Braille : OutputMode::Ascii;
+            }
+
+
+            // Switch the grid of copies of the model on and off
+            if (keyPressed('G'))
+            {
+                instanceGrid = !instanceGrid;
+            }
+
+
+            // Put up or take down the wall in front of the model
+            if (keyPressed('B'))
+            {
+                wallShown = !wallShown;
+            }
+
+
             // Calculates deltaTime
             auto currentTime = std::chrono::steady_clock::now();
             std::chrono::duration<float> elapsedTime = currentTime - previousTime;
@@ -581,21 +5330,23 @@ int main() {
             // Calculate the transformation matrices
             glm::mat4 projection = glm::perspective(fov, aspectRatio, nearPlane, farPlane);
             cubeRotation = glm::rotate(glm::mat4(1.0f), angle, glm::vec3(1.0f, 1.0f, 1.0f));
-            glm::mat4 model = glm::translate(glm::mat4(1.0f), cubePosition) * cubeRotation;
-            glm::mat4 MVP = projection * view * model;
-
-
-            // Apply transformations and draw the updated cube
-            applyTransform(MVP);
-            int numVertices = sizeof(transformedVertices) / sizeof(transformedVertices[0]);
-            std::vector<std::tuple<int, int, float>> triangles = triangulateWithIndices(transformedVertices, numVertices, indices, sizeof(indices) / sizeof(indices[0]));
-
 
-            // Prints the final product
-            render(triangles);
 
-
-            std::cout << deltaTime;
+            // Hand the frame to the raster thread, which owns the scene
+            SimulationFrame& frame = simulationFrames.writeBuffer();
+            frame.viewProjection = projection * view;
+            frame.localTransforms[modelNode] = glm::translate(glm::mat4(1.0f), cubePosition) * cubeRotation * fitModel;
+            frame.hiddenNodes[wallNode] = !wallShown;
+            frame.instanceMesh = &mesh;
+            frame.instanceCount = instanceGrid ? instanceGridSize * instanceGridSize : 0;
+            for (int i = 0; i < frame.instanceCount; i++) {
+                glm::vec3 offset((i % instanceGridSize - 0.5f * (instanceGridSize - 1)) * instanceSpacing, 0.0f, -(i / instanceGridSize + 1) * instanceSpacing);
+                frame.instances[i] = glm::translate(glm::mat4(1.0f), cubePosition + offset) * cubeRotation * fitModel;
+            }
+            frame.cameraPos = cameraPos;
+            frame.settings = settings;
+            frame.deltaTime = deltaTime;
+            simulationFrames.publish();
         }
     }
     catch (const std::exception& e) {
@@ -603,6 +5354,9 @@ int main() {
     }
 
 
+    stopTileWorkers();
+
+
     return 0;
 }
 